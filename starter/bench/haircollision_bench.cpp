@@ -0,0 +1,105 @@
+// Times HairCollision::update on synthetic grooms of 24 to 10000 strands,
+// all equally dense, so the time per segment should stay flat: once
+// rebuilding the neighbour lists, and once reusing them.
+//
+//   haircollision_bench [threads]    0 or nothing = one per core
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "haircollision.h"
+
+using namespace std;
+
+namespace {
+  const int LENGTH = 16;
+  const float SEGMENT = 0.3f;
+  // between neighbouring roots, and how far each segment leans
+  const float SPACING = 0.25f;
+  const float SWAY = 0.5f;
+  // what HairGroup collides its strands with
+  const float CLUMP_R = 0.05f;
+  const float CLUMP_K = 50.0f;
+  const float CLUMP_DAMPING = 0.05f;
+  const float CLUMP_COHESION = 2.0f;
+  const float CLUMP_COHESION_RANGE = 0.05f;
+  const float CLUMP_SKIN = 0.1f;
+  const float MASS = 0.01f;
+
+  // the same grooms on every run and platform
+  unsigned int seed = 1;
+  float random01() {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0f;
+  }
+
+  // Strands rooted on a square grid of the given spacing, hanging down
+  // with a random sway at every particle, so the groom only grows sideways
+  // and stays as dense whatever the count. Laid out like
+  // HairGroup::groupState(), at rest.
+  vector<float> makeGroom(int strands, float spacing) {
+    int side = (int) ceil(sqrt((float) strands));
+    vector<float> state(strands * 6 * LENGTH, 0.0f);
+    for (int s = 0; s < strands; s++) {
+      float* x = &state[s * 6 * LENGTH];
+      float* y = x + LENGTH;
+      float* z = y + LENGTH;
+      float p[3] = { spacing * (s % side), 0, spacing * (s / side) };
+      for (int i = 0; i < LENGTH; i++) {
+        x[i] = p[0];
+        y[i] = p[1];
+        z[i] = p[2];
+        float d[3] = { SWAY * (random01() - 0.5f), -1, SWAY * (random01() - 0.5f) };
+        float len = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        for (int c = 0; c < 3; c++) {
+          p[c] += SEGMENT * d[c] / len;
+        }
+      }
+    }
+    return state;
+  }
+
+  // seconds per update, over as many as fit in half a second; rebuild
+  // makes every one of them rebuild the lists
+  double timeUpdates(HairCollision& collision, const vector<float>& state, int strands,
+                     const vector<char>& awake, bool rebuild, ThreadPool& pool) {
+    int updates = 0;
+    double elapsed = 0;
+    auto start = chrono::steady_clock::now();
+    while (updates < 3 || elapsed < 0.5) {
+      if (rebuild) {
+        collision.setSkin(CLUMP_SKIN);
+      }
+      collision.update(&state[0], strands, LENGTH, &awake[0], pool);
+      updates++;
+      elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    return elapsed / updates;
+  }
+}
+
+int main(int argc, char** argv) {
+  ThreadPool pool(argc > 1 ? atoi(argv[1]) : 0);
+  printf("%d threads\n", pool.threadCount());
+  printf("%8s %10s %12s %12s %14s %16s\n", "strands", "segments", "ms/rebuild", "ms/reuse", "ns/segment",
+         "contacts/segment");
+
+  const int counts[] = { 24, 100, 1000, 10000 };
+  for (int strands : counts) {
+    vector<float> state = makeGroom(strands, SPACING);
+    vector<char> awake(strands, 1);
+    HairCollision collision(CLUMP_R, CLUMP_K, CLUMP_DAMPING, MASS, CLUMP_COHESION, CLUMP_COHESION_RANGE,
+                            CLUMP_SKIN);
+    int segments = strands * (LENGTH - 1);
+
+    // one update to size the buffers
+    collision.update(&state[0], strands, LENGTH, &awake[0], pool);
+    double rebuild = timeUpdates(collision, state, strands, awake, true, pool);
+    double reuse = timeUpdates(collision, state, strands, awake, false, pool);
+    printf("%8d %10d %12.3f %12.3f %14.1f %16.2f\n", strands, segments, 1e3 * rebuild, 1e3 * reuse,
+           1e9 * rebuild / segments, (double) collision.contacts() / segments);
+  }
+  return 0;
+}
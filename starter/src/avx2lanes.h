@@ -0,0 +1,39 @@
+#ifndef HAIR_SIMULATION_AVX2LANES_H
+#define HAIR_SIMULATION_AVX2LANES_H
+
+#include <immintrin.h>
+
+// ScalarLanes (scalarlanes.h) for AVX2, 8 floats per instruction. Only
+// for files built with -mavx2 -ffp-contract=off, whose functions are
+// only called after detectSimdLevel() has seen AVX2 on the CPU.
+struct Avx2Lanes {
+  typedef __m256 V;
+  typedef __m256i I;
+  typedef __m256 Mask;
+  static const int width = 8;
+
+  static V load(const float* p) { return _mm256_loadu_ps(p); }
+  static void store(float* p, V a) { _mm256_storeu_ps(p, a); }
+  static V set1(float a) { return _mm256_set1_ps(a); }
+  static V add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm256_div_ps(a, b); }
+  static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+  static V floor(V a) { return _mm256_floor_ps(a); }
+  static V min(V a, V b) { return _mm256_min_ps(a, b); }
+  static V max(V a, V b) { return _mm256_max_ps(a, b); }
+  static Mask less(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static Mask equal(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+  static Mask both(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+  static V select(Mask m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+
+  static I seti(int a) { return _mm256_set1_epi32(a); }
+  static I addi(I a, I b) { return _mm256_add_epi32(a, b); }
+  static I muli(I a, I b) { return _mm256_mullo_epi32(a, b); }
+  static I toInt(V a) { return _mm256_cvttps_epi32(a); }
+  static V toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+  static V gather(const float* base, I index) { return _mm256_i32gather_ps(base, index, 4); }
+};
+
+#endif //HAIR_SIMULATION_AVX2LANES_H
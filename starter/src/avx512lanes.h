@@ -0,0 +1,39 @@
+#ifndef HAIR_SIMULATION_AVX512LANES_H
+#define HAIR_SIMULATION_AVX512LANES_H
+
+#include <immintrin.h>
+
+// ScalarLanes (scalarlanes.h) for AVX-512, 16 floats per instruction.
+// Only for files built with -mavx512f -ffp-contract=off, whose functions
+// are only called after detectSimdLevel() has seen AVX-512F on the CPU.
+struct Avx512Lanes {
+  typedef __m512 V;
+  typedef __m512i I;
+  typedef __mmask16 Mask;
+  static const int width = 16;
+
+  static V load(const float* p) { return _mm512_loadu_ps(p); }
+  static void store(float* p, V a) { _mm512_storeu_ps(p, a); }
+  static V set1(float a) { return _mm512_set1_ps(a); }
+  static V add(V a, V b) { return _mm512_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm512_div_ps(a, b); }
+  static V sqrt(V a) { return _mm512_sqrt_ps(a); }
+  static V floor(V a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+  static V min(V a, V b) { return _mm512_min_ps(a, b); }
+  static V max(V a, V b) { return _mm512_max_ps(a, b); }
+  static Mask less(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+  static Mask equal(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+  static Mask both(Mask a, Mask b) { return a & b; }
+  static V select(Mask m, V a, V b) { return _mm512_mask_blend_ps(m, b, a); }
+
+  static I seti(int a) { return _mm512_set1_epi32(a); }
+  static I addi(I a, I b) { return _mm512_add_epi32(a, b); }
+  static I muli(I a, I b) { return _mm512_mullo_epi32(a, b); }
+  static I toInt(V a) { return _mm512_cvttps_epi32(a); }
+  static V toFloat(I a) { return _mm512_cvtepi32_ps(a); }
+  static V gather(const float* base, I index) { return _mm512_i32gather_ps(index, base, 4); }
+};
+
+#endif //HAIR_SIMULATION_AVX512LANES_H
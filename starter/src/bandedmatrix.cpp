@@ -0,0 +1,162 @@
+#include "bandedmatrix.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+  // small row-major 3x3 helpers
+
+  // c = a * b
+  void mul(const float* a, const float* b, float* c) {
+    for (int r = 0; r < 3; r++) {
+      for (int k = 0; k < 3; k++) {
+        c[3 * r + k] = a[3 * r] * b[k] + a[3 * r + 1] * b[3 + k] + a[3 * r + 2] * b[6 + k];
+      }
+    }
+  }
+
+  // c -= a * b^T
+  void subMulTransposed(const float* a, const float* b, float* c) {
+    for (int r = 0; r < 3; r++) {
+      for (int k = 0; k < 3; k++) {
+        c[3 * r + k] -= a[3 * r] * b[3 * k] + a[3 * r + 1] * b[3 * k + 1] + a[3 * r + 2] * b[3 * k + 2];
+      }
+    }
+  }
+
+  bool invert(const float* m, float* inv) {
+    float c00 = m[4] * m[8] - m[5] * m[7];
+    float c01 = m[5] * m[6] - m[3] * m[8];
+    float c02 = m[3] * m[7] - m[4] * m[6];
+    float det = m[0] * c00 + m[1] * c01 + m[2] * c02;
+    if (fabs(det) < 1e-20f) {
+      return false;
+    }
+    float s = 1.0f / det;
+    inv[0] = c00 * s;
+    inv[1] = (m[2] * m[7] - m[1] * m[8]) * s;
+    inv[2] = (m[1] * m[5] - m[2] * m[4]) * s;
+    inv[3] = c01 * s;
+    inv[4] = (m[0] * m[8] - m[2] * m[6]) * s;
+    inv[5] = (m[2] * m[3] - m[0] * m[5]) * s;
+    inv[6] = c02 * s;
+    inv[7] = (m[1] * m[6] - m[0] * m[7]) * s;
+    inv[8] = (m[0] * m[4] - m[1] * m[3]) * s;
+    return true;
+  }
+}
+
+BandedBlockMatrix::BandedBlockMatrix(float* storage, int n, int bandwidth)
+  : data(storage), n(n), b(bandwidth) {
+  diag = data + 9 * n * (b + 1);
+  diagInv = diag + 9 * n;
+}
+
+size_t BandedBlockMatrix::storageSize(int n, int bandwidth) {
+  return 9 * (size_t) n * (bandwidth + 3);
+}
+
+void BandedBlockMatrix::clear() {
+  memset(data, 0, 9 * n * (b + 1) * sizeof(float));
+}
+
+void BandedBlockMatrix::addDiagonal(int i, float s) {
+  float* d = block(i, i);
+  d[0] += s;
+  d[4] += s;
+  d[8] += s;
+}
+
+void BandedBlockMatrix::addSpring(int i, int j, const float J[9]) {
+  float* ii = block(i, i);
+  float* jj = block(j, j);
+  float* ij = block(i, j);
+  for (int k = 0; k < 9; k++) {
+    ii[k] += J[k];
+    jj[k] += J[k];
+    ij[k] -= J[k];
+  }
+}
+
+void BandedBlockMatrix::scale(float s) {
+  int count = 9 * n * (b + 1);
+  for (int k = 0; k < count; k++) {
+    data[k] *= s;
+  }
+}
+
+void BandedBlockMatrix::pin(int i) {
+  for (int j = max(0, i - b); j < i; j++) {
+    memset(block(i, j), 0, 9 * sizeof(float));
+  }
+  for (int k = i + 1; k <= min(n - 1, i + b); k++) {
+    memset(block(k, i), 0, 9 * sizeof(float));
+  }
+  float* d = block(i, i);
+  memset(d, 0, 9 * sizeof(float));
+  d[0] = d[4] = d[8] = 1;
+}
+
+bool BandedBlockMatrix::factor() {
+  float w[9];
+  for (int i = 0; i < n; i++) {
+    int first = max(0, i - b);
+
+    // L(i,j) = (A(i,j) - sum_k L(i,k) D(k) L(j,k)^T) D(j)^-1
+    for (int j = first; j < i; j++) {
+      float* lij = block(i, j);
+      for (int k = first; k < j; k++) {
+        mul(block(i, k), diag + 9 * k, w);
+        subMulTransposed(w, block(j, k), lij);
+      }
+      memcpy(w, lij, sizeof(w));
+      mul(w, diagInv + 9 * j, lij);
+    }
+
+    // D(i) = A(i,i) - sum_k L(i,k) D(k) L(i,k)^T
+    float* di = diag + 9 * i;
+    memcpy(di, block(i, i), 9 * sizeof(float));
+    for (int k = first; k < i; k++) {
+      mul(block(i, k), diag + 9 * k, w);
+      subMulTransposed(w, block(i, k), di);
+    }
+    if (!invert(di, diagInv + 9 * i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BandedBlockMatrix::solve(float* x, float* y, float* z) const {
+  // forward substitution with the unit lower triangle
+  for (int i = 0; i < n; i++) {
+    for (int k = max(0, i - b); k < i; k++) {
+      const float* l = block(i, k);
+      x[i] -= l[0] * x[k] + l[1] * y[k] + l[2] * z[k];
+      y[i] -= l[3] * x[k] + l[4] * y[k] + l[5] * z[k];
+      z[i] -= l[6] * x[k] + l[7] * y[k] + l[8] * z[k];
+    }
+  }
+
+  // block diagonal
+  for (int i = 0; i < n; i++) {
+    const float* d = diagInv + 9 * i;
+    float vx = x[i], vy = y[i], vz = z[i];
+    x[i] = d[0] * vx + d[1] * vy + d[2] * vz;
+    y[i] = d[3] * vx + d[4] * vy + d[5] * vz;
+    z[i] = d[6] * vx + d[7] * vy + d[8] * vz;
+  }
+
+  // back substitution with L^T
+  for (int i = n - 1; i >= 0; i--) {
+    for (int k = i + 1; k <= min(n - 1, i + b); k++) {
+      const float* l = block(k, i);
+      x[i] -= l[0] * x[k] + l[3] * y[k] + l[6] * z[k];
+      y[i] -= l[1] * x[k] + l[4] * y[k] + l[7] * z[k];
+      z[i] -= l[2] * x[k] + l[5] * y[k] + l[8] * z[k];
+    }
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef HAIR_SIMULATION_BANDEDMATRIX_H
+#define HAIR_SIMULATION_BANDEDMATRIX_H
+
+#include <cstddef>
+
+// Symmetric matrix made of n x n blocks of 3x3, where block (i, j) is zero
+// whenever |i - j| > bandwidth. This is the shape of the Jacobian of a
+// strand: particle i only has springs to particles i+1 .. i+bandwidth.
+//
+// Only the lower band is stored, block (i, j) for i - bandwidth <= j <= i,
+// each block row major. The matrix does not own its storage so it can
+// live in integrator scratch; storageSize() tells how much it needs.
+//
+// factor() computes an in-place block LDL^T decomposition and solve()
+// then solves in O(n * bandwidth^2) instead of O(n^3) for a dense solve.
+class BandedBlockMatrix {
+public:
+  BandedBlockMatrix(float* storage, int n, int bandwidth);
+
+  static size_t storageSize(int n, int bandwidth);
+
+  int size() const { return n; }
+  int bandwidth() const { return b; }
+
+  // set every stored block to zero
+  void clear();
+
+  // block (i, j), with i - bandwidth <= j <= i
+  float* block(int i, int j) { return data + 9 * (i * (b + 1) + (j - i + b)); }
+  const float* block(int i, int j) const { return data + 9 * (i * (b + 1) + (j - i + b)); }
+
+  // add s * I to the diagonal block of row i
+  void addDiagonal(int i, float s);
+
+  // add the contribution of a spring between particles i and j (j < i)
+  // with 3x3 Jacobian J: +J on both diagonal blocks, -J on block (i, j)
+  void addSpring(int i, int j, const float J[9]);
+
+  // scale every block by s
+  void scale(float s);
+
+  // decouple row and column i from the rest and make its diagonal I,
+  // so the solve leaves that entry of the right hand side untouched
+  void pin(int i);
+
+  // Factor in place. Afterwards the strictly lower blocks hold L and the
+  // matrix can only be used for solve(). Returns false on a singular pivot.
+  bool factor();
+
+  // solve A v = r in place for a vector given as separate x/y/z arrays
+  void solve(float* x, float* y, float* z) const;
+
+private:
+  float* data;
+  // D and D^-1 of the factorisation, after the band storage
+  float* diag;
+  float* diagInv;
+  int n;
+  int b;
+};
+
+#endif //HAIR_SIMULATION_BANDEDMATRIX_H
@@ -0,0 +1,45 @@
+#ifndef HAIR_SIMULATION_COLLIDER_H
+#define HAIR_SIMULATION_COLLIDER_H
+
+#include <cstdint>
+#include <vecmath.h>
+
+// the distance of points nothing is near, whatever the collider
+const float COLLIDER_FAR = 1e30f;
+
+// What the hair collides with: a signed distance, negative inside, and
+// the unit outward normal at any point. Strands only hold a pointer to
+// one, so the head, a baked distance field and a mesh look the same to
+// the force kernels.
+class Collider {
+public:
+  virtual ~Collider() {}
+
+  // Distances at n points, given and returned one component per array
+  // as the force kernels hold them. Where nothing is near, d is
+  // COLLIDER_FAR and the normal zero.
+  //
+  // hint, if not null, holds one int per point that the collider may
+  // use to remember where it found the point last time; start them at
+  // -1 and hand the same ones back for the same particles. It only
+  // makes lookups faster; at most the rounding of a normal can differ
+  // where two features are equally close.
+  virtual void query(int n, const float* x, const float* y, const float* z,
+                     float* d, float* nx, float* ny, float* nz, int* hint) const = 0;
+
+  // hash of the shape chained onto h, for cache keys
+  virtual uint64_t hash(uint64_t h) const = 0;
+
+  // query() for one point, with the normal if normal isn't null
+  float distance(const Vector3f& p, Vector3f* normal = nullptr, int* hint = nullptr) const {
+    float x = p.x(), y = p.y(), z = p.z();
+    float d, nx, ny, nz;
+    query(1, &x, &y, &z, &d, &nx, &ny, &nz, hint);
+    if (normal) {
+      *normal = Vector3f(nx, ny, nz);
+    }
+    return d;
+  }
+};
+
+#endif //HAIR_SIMULATION_COLLIDER_H
@@ -0,0 +1,99 @@
+#include "distancefield.h"
+#include "distancefieldkernel.h"
+#include "scalarlanes.h"
+#include "mappedfile.h"
+#include "settlecache.h"
+
+#include <cstring>
+
+using namespace std;
+
+#ifdef HAIR_SIMD_X86
+// distancefield_avx2.cpp and distancefield_avx512.cpp
+void queryFieldAvx2(const DistanceField::Params& p, int n, const float* x, const float* y, const float* z,
+                    float* d, float* nx, float* ny, float* nz);
+void queryFieldAvx512(const DistanceField::Params& p, int n, const float* x, const float* y, const float* z,
+                      float* d, float* nx, float* ny, float* nz);
+#endif
+
+namespace {
+  const char MAGIC[8] = { 'H', 'A', 'I', 'R', 'S', 'D', 'F', '1' };
+}
+
+void DistanceField::bakeSphere(float radius, float margin, float cell) {
+  float extent = radius + margin;
+  bake(Vector3f(-extent), Vector3f(extent), cell, [radius](const Vector3f& p) {
+    return p.abs() - radius;
+  });
+}
+
+bool DistanceField::load(const string& path) {
+  MappedFile file;
+  if (!file.open(path) || file.size() < sizeof(DistanceFieldHeader)) {
+    return false;
+  }
+  DistanceFieldHeader header;
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != DISTANCE_FIELD_VERSION ||
+      header.dims[0] < 2 || header.dims[1] < 2 || header.dims[2] < 2 || !(header.cell > 0) ||
+      header.dataOffset < sizeof(header)) {
+    return false;
+  }
+  size_t count = (size_t) header.dims[0] * header.dims[1] * header.dims[2];
+  if (file.size() < header.dataOffset + count * sizeof(float)) {
+    return false;
+  }
+
+  for (int c = 0; c < 3; c++) {
+    dims[c] = header.dims[c];
+    origin[c] = header.origin[c];
+  }
+  cell = header.cell;
+  inverseCell = 1 / cell;
+  values.resize(count);
+  memcpy(&values[0], file.data() + header.dataOffset, count * sizeof(float));
+  return true;
+}
+
+void DistanceField::query(int n, const float* x, const float* y, const float* z,
+                          float* d, float* nx, float* ny, float* nz, int* hint) const {
+  if (empty()) {
+    for (int i = 0; i < n; i++) {
+      d[i] = COLLIDER_FAR;
+      nx[i] = ny[i] = nz[i] = 0;
+    }
+    return;
+  }
+
+  Params p;
+  p.values = &values[0];
+  p.inverseCell = inverseCell;
+  for (int c = 0; c < 3; c++) {
+    p.origin[c] = origin[c];
+    p.top[c] = dims[c] - 1;
+    p.last[c] = dims[c] - 2;
+  }
+  p.strideY = dims[0];
+  p.strideZ = dims[0] * dims[1];
+
+  switch (level) {
+#ifdef HAIR_SIMD_X86
+    case SIMD_AVX512:
+      queryFieldAvx512(p, n, x, y, z, d, nx, ny, nz);
+      break;
+    case SIMD_AVX2:
+      queryFieldAvx2(p, n, x, y, z, d, nx, ny, nz);
+      break;
+#endif
+    default:
+      queryField<ScalarLanes>(p, n, x, y, z, d, nx, ny, nz);
+      break;
+  }
+}
+
+uint64_t DistanceField::hash(uint64_t h) const {
+  h = hashBytes(dims, sizeof(dims), h);
+  h = hashBytes(&origin[0], 3 * sizeof(float), h);
+  h = hashBytes(&cell, sizeof(cell), h);
+  return values.empty() ? h : hashBytes(&values[0], values.size() * sizeof(float), h);
+}
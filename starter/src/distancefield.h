@@ -0,0 +1,107 @@
+#ifndef HAIR_SIMULATION_DISTANCEFIELD_H
+#define HAIR_SIMULATION_DISTANCEFIELD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vecmath.h>
+#include "collider.h"
+#include "strandbatch.h"
+
+// A collider given as a signed distance field on a regular grid:
+// negative inside, positive outside. Distances between grid points
+// are interpolated trilinearly and the normal is the normalized gradient
+// of that interpolation, so a lookup costs the same few loads whatever
+// the shape. Outside the grid nothing collides. Points are looked up
+// one per SIMD lane, with the same kernel for every instruction set
+// (distancefieldkernel.h).
+//
+// On disk a field is a DistanceFieldHeader followed by the grid values,
+// x fastest, at a 64 byte aligned offset.
+
+// bump whenever the file layout changes
+const uint32_t DISTANCE_FIELD_VERSION = 1;
+
+struct DistanceFieldHeader {
+  // "HAIRSDF1"
+  char magic[8];
+  uint32_t version;
+  // offset of the values from the start of the file
+  uint32_t dataOffset;
+  // grid points along x, y and z, at least 2 each
+  int32_t dims[3];
+  // position of the first grid point and the spacing of the grid
+  float origin[3];
+  float cell;
+};
+
+class DistanceField : public Collider {
+public:
+  DistanceField() : level(detectSimdLevel()), cell(1), inverseCell(1) {
+    dims[0] = dims[1] = dims[2] = 0;
+  }
+
+  // Sample distance(Vector3f) at the grid points of the box from lo to
+  // hi, cell apart; the box is rounded up to whole cells.
+  template <class F>
+  void bake(const Vector3f& lo, const Vector3f& hi, float cell, F distance);
+  // a sphere around the origin, on a grid reaching margin beyond it
+  void bakeSphere(float radius, float margin, float cell);
+
+  // returns false, leaving the field alone, if the file can't be read
+  bool load(const std::string& path);
+
+  bool empty() const { return values.empty(); }
+  // capped at detectSimdLevel(), which is the default
+  void setSimdLevel(SimdLevel level) { this->level = std::min(level, detectSimdLevel()); }
+
+  // Points outside the grid cost a bounds test, so a grid hugging the
+  // collider keeps most lookups to that. Takes no hints.
+  void query(int n, const float* x, const float* y, const float* z,
+             float* d, float* nx, float* ny, float* nz, int* hint) const override;
+  uint64_t hash(uint64_t h) const override;
+
+  // what query() needs, in plain values for the kernel
+  struct Params {
+    const float* values;
+    float origin[3];
+    float inverseCell;
+    // the last grid point and the last cell along each axis
+    float top[3];
+    int last[3];
+    // values from one row and one slice to the next
+    int strideY;
+    int strideZ;
+  };
+
+private:
+  SimdLevel level;
+  int dims[3];
+  Vector3f origin;
+  float cell;
+  float inverseCell;
+  std::vector<float> values;
+};
+
+template <class F>
+void DistanceField::bake(const Vector3f& lo, const Vector3f& hi, float cell, F distance) {
+  for (int c = 0; c < 3; c++) {
+    dims[c] = std::max(2, (int) std::ceil((hi[c] - lo[c]) / cell) + 1);
+  }
+  origin = lo;
+  this->cell = cell;
+  inverseCell = 1 / cell;
+  values.resize(dims[0] * dims[1] * dims[2]);
+  for (int k = 0; k < dims[2]; k++) {
+    for (int j = 0; j < dims[1]; j++) {
+      for (int i = 0; i < dims[0]; i++) {
+        Vector3f p = origin + cell * Vector3f(i, j, k);
+        values[(k * dims[1] + j) * dims[0] + i] = distance(p);
+      }
+    }
+  }
+}
+
+#endif //HAIR_SIMULATION_DISTANCEFIELD_H
@@ -0,0 +1,14 @@
+// AVX2 version of the distance field lookup, 8 points per instruction.
+// Built with -mavx2 -ffp-contract=off and only called after
+// detectSimdLevel() has seen AVX2 on the CPU.
+#ifdef HAIR_SIMD_X86
+
+#include "avx2lanes.h"
+#include "distancefieldkernel.h"
+
+void queryFieldAvx2(const DistanceField::Params& p, int n, const float* x, const float* y, const float* z,
+                    float* d, float* nx, float* ny, float* nz) {
+  queryField<Avx2Lanes>(p, n, x, y, z, d, nx, ny, nz);
+}
+
+#endif
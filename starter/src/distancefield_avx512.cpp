@@ -0,0 +1,14 @@
+// AVX-512 version of the distance field lookup, 16 points per
+// instruction. Built with -mavx512f -ffp-contract=off and only called
+// after detectSimdLevel() has seen AVX-512F on the CPU.
+#ifdef HAIR_SIMD_X86
+
+#include "avx512lanes.h"
+#include "distancefieldkernel.h"
+
+void queryFieldAvx512(const DistanceField::Params& p, int n, const float* x, const float* y, const float* z,
+                      float* d, float* nx, float* ny, float* nz) {
+  queryField<Avx512Lanes>(p, n, x, y, z, d, nx, ny, nz);
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef HAIR_SIMULATION_DISTANCEFIELDKERNEL_H
+#define HAIR_SIMULATION_DISTANCEFIELDKERNEL_H
+
+#include "distancefield.h"
+
+// The distance field lookup, written once over a Lanes type like the
+// batch force kernel (strandbatchkernel.h), plus integer vectors:
+//   I, seti, addi, muli, toInt (truncating), toFloat and gather(base, I),
+// and min, max, equal and both for the bounds test. It is included by
+// distancefield.cpp for the scalar version and by one file per
+// instruction set. Every lane reads a cell of the grid, points outside
+// it the clamped nearest one, and a mask then gives those COLLIDER_FAR.
+// min and max return their second argument for NaN, as SSE does, so a
+// NaN point clamps to the grid too and fails the test.
+
+// Distance and normal at the L::width points from x, y and z; see
+// DistanceField::query.
+template <class L>
+void queryFieldLanes(const DistanceField::Params& p, const float* x, const float* y, const float* z,
+                     float* d, float* nx, float* ny, float* nz) {
+  typedef typename L::V V;
+  typedef typename L::I I;
+  typedef typename L::Mask Mask;
+  const V zero = L::set1(0);
+  const V one = L::set1(1);
+  const V scale = L::set1(p.inverseCell);
+
+  // grid coordinates, clamped into the grid; a point is inside where
+  // clamping didn't move it
+  V u = L::mul(L::sub(L::load(x), L::set1(p.origin[0])), scale);
+  V v = L::mul(L::sub(L::load(y), L::set1(p.origin[1])), scale);
+  V w = L::mul(L::sub(L::load(z), L::set1(p.origin[2])), scale);
+  V cu = L::min(L::max(u, zero), L::set1(p.top[0]));
+  V cv = L::min(L::max(v, zero), L::set1(p.top[1]));
+  V cw = L::min(L::max(w, zero), L::set1(p.top[2]));
+  Mask inside = L::both(L::both(L::equal(u, cu), L::equal(v, cv)), L::equal(w, cw));
+
+  I i = L::toInt(L::min(cu, L::set1((float) p.last[0])));
+  I j = L::toInt(L::min(cv, L::set1((float) p.last[1])));
+  I l = L::toInt(L::min(cw, L::set1((float) p.last[2])));
+  V fx = L::sub(cu, L::toFloat(i));
+  V fy = L::sub(cv, L::toFloat(j));
+  V fz = L::sub(cw, L::toFloat(l));
+
+  I cell = L::addi(L::addi(L::muli(l, L::seti(p.strideZ)), L::muli(j, L::seti(p.strideY))), i);
+  const float* g = p.values;
+  int sy = p.strideY, sz = p.strideZ;
+  V c000 = L::gather(g, cell), c100 = L::gather(g + 1, cell);
+  V c010 = L::gather(g + sy, cell), c110 = L::gather(g + sy + 1, cell);
+  V c001 = L::gather(g + sz, cell), c101 = L::gather(g + sz + 1, cell);
+  V c011 = L::gather(g + sz + sy, cell), c111 = L::gather(g + sz + sy + 1, cell);
+
+  // along x, then y, then z
+  V c00 = L::add(c000, L::mul(fx, L::sub(c100, c000)));
+  V c10 = L::add(c010, L::mul(fx, L::sub(c110, c010)));
+  V c01 = L::add(c001, L::mul(fx, L::sub(c101, c001)));
+  V c11 = L::add(c011, L::mul(fx, L::sub(c111, c011)));
+  V c0 = L::add(c00, L::mul(fy, L::sub(c10, c00)));
+  V c1 = L::add(c01, L::mul(fy, L::sub(c11, c01)));
+  V dist = L::add(c0, L::mul(fz, L::sub(c1, c0)));
+
+  // gradient of the same interpolation, up to the cell size
+  V ry = L::sub(one, fy), rz = L::sub(one, fz);
+  V gx = L::add(L::mul(L::add(L::mul(L::sub(c100, c000), ry), L::mul(L::sub(c110, c010), fy)), rz),
+                L::mul(L::add(L::mul(L::sub(c101, c001), ry), L::mul(L::sub(c111, c011), fy)), fz));
+  V gy = L::add(L::mul(L::sub(c10, c00), rz), L::mul(L::sub(c11, c01), fz));
+  V gz = L::sub(c1, c0);
+  V len = L::sqrt(L::add(L::add(L::mul(gx, gx), L::mul(gy, gy)), L::mul(gz, gz)));
+  V r = L::select(L::less(zero, len), L::div(one, len), zero);
+
+  L::store(d, L::select(inside, dist, L::set1(COLLIDER_FAR)));
+  L::store(nx, L::select(inside, L::mul(gx, r), zero));
+  L::store(ny, L::select(inside, L::mul(gy, r), zero));
+  L::store(nz, L::select(inside, L::mul(gz, r), zero));
+}
+
+// every point, a vector at a time, the last few through a padded copy
+template <class L>
+void queryField(const DistanceField::Params& p, int n, const float* x, const float* y, const float* z,
+                float* d, float* nx, float* ny, float* nz) {
+  int k = 0;
+  for (; k + L::width <= n; k += L::width) {
+    queryFieldLanes<L>(p, x + k, y + k, z + k, d + k, nx + k, ny + k, nz + k);
+  }
+  if (k < n) {
+    float in[3][L::width] = {}, out[4][L::width];
+    for (int m = k; m < n; m++) {
+      in[0][m - k] = x[m];
+      in[1][m - k] = y[m];
+      in[2][m - k] = z[m];
+    }
+    queryFieldLanes<L>(p, in[0], in[1], in[2], out[0], out[1], out[2], out[3]);
+    for (int m = k; m < n; m++) {
+      d[m] = out[0][m - k];
+      nx[m] = out[1][m - k];
+      ny[m] = out[2][m - k];
+      nz[m] = out[3][m - k];
+    }
+  }
+}
+
+#endif //HAIR_SIMULATION_DISTANCEFIELDKERNEL_H
@@ -0,0 +1,41 @@
+#include "framescheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+FrameScheduler::FrameScheduler(double step, double budget)
+  : step(step), frameBudget(budget), accumulator(0), droppedTime(0) {}
+
+int FrameScheduler::advance(double dt) {
+  accumulator += dt;
+  int steps = (int) floor(accumulator / step);
+  int cap = maxSteps();
+  if (steps > cap) {
+    // keep the fraction of a step, drop the rest
+    double excess = (steps - cap) * step;
+    accumulator -= excess;
+    droppedTime += excess;
+    steps = cap;
+  }
+  accumulator -= steps * step;
+  return steps;
+}
+
+double FrameScheduler::advanceTime(double dt) {
+  double t = min(dt, frameBudget);
+  droppedTime += dt - t;
+  return t;
+}
+
+void FrameScheduler::setBudget(double budget) {
+  frameBudget = budget;
+}
+
+int FrameScheduler::maxSteps() const {
+  if (step <= 0) {
+    return 1;
+  }
+  return max(1, (int) floor(frameBudget / step));
+}
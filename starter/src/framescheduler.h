@@ -0,0 +1,37 @@
+#ifndef HAIR_SIMULATION_FRAMESCHEDULER_H
+#define HAIR_SIMULATION_FRAMESCHEDULER_H
+
+// Fixed-step scheduling against the wall clock. Real time accumulates
+// and is paid out in whole steps, but never more than the frame budget
+// at once: time beyond it is dropped instead of carried over, so after a
+// stall the simulation slows down for a moment rather than falling
+// further and further behind, stepping more to catch up each frame.
+class FrameScheduler {
+public:
+  // step: the fixed step size, or 0 for adaptive steppers that take any
+  // interval; budget: the most simulated seconds per frame
+  FrameScheduler(double step, double budget);
+
+  // add dt seconds of real time and return the number of steps to take now
+  int advance(double dt);
+  // the same for adaptive steppers: the seconds to advance now
+  double advanceTime(double dt);
+
+  // real time accumulated but not stepped yet, less than one step
+  double leftover() const { return accumulator; }
+  // total real time dropped to stay within the budget
+  double dropped() const { return droppedTime; }
+
+  void setBudget(double budget);
+  double budget() const { return frameBudget; }
+  // steps per frame the budget allows, at least one
+  int maxSteps() const;
+
+private:
+  double step;
+  double frameBudget;
+  double accumulator;
+  double droppedTime;
+};
+
+#endif //HAIR_SIMULATION_FRAMESCHEDULER_H
@@ -0,0 +1,487 @@
+#include "haircollision.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+  // segments or buckets per chunk of parallel work
+  const int GRAIN = 4096;
+  // cells are at least the longest segment over this, so a segment
+  // covers a few cells along each axis at most
+  const int MAX_SPAN = 8;
+  // cells further out than this share the outermost ones, which only
+  // costs lookups; it also keeps NaN positions in range
+  const float MAX_CELL = 1 << 20;
+
+  inline int cellOf(float v, float inverseCell) {
+    float c = floor(v * inverseCell);
+    return (int) (c < MAX_CELL ? (c > -MAX_CELL ? c : -MAX_CELL) : MAX_CELL);
+  }
+
+  inline float dot(const float* a, const float* b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+  inline float clamp01(float v) { return v < 0 ? 0 : v > 1 ? 1 : v; }
+
+  // Parameters s and t of the closest points of the segments p0 + s d1
+  // and q0 + t d2, r = p0 - q0 (Ericson, Real-Time Collision Detection,
+  // 5.1.9)
+  inline void closestOnSegments(const float* d1, const float* d2, const float* r, float& s, float& t) {
+    const float EPSILON = 1e-12f;
+    float a = dot(d1, d1), e = dot(d2, d2), f = dot(d2, r);
+    if (a <= EPSILON && e <= EPSILON) {
+      s = t = 0;
+      return;
+    }
+    if (a <= EPSILON) {
+      s = 0;
+      t = clamp01(f / e);
+      return;
+    }
+    float c = dot(d1, r);
+    if (e <= EPSILON) {
+      t = 0;
+      s = clamp01(-c / a);
+      return;
+    }
+    float b = dot(d1, d2);
+    float denom = a * e - b * b;
+    s = denom != 0 ? clamp01((b * f - c * e) / denom) : 0;
+    t = (b * s + f) / e;
+    if (t < 0) {
+      t = 0;
+      s = clamp01(-c / a);
+    } else if (t > 1) {
+      t = 1;
+      s = clamp01((b - c) / a);
+    }
+  }
+}
+
+HairCollision::HairCollision(float radius, float stiffness, float damping, float mass,
+                             float cohesion, float cohesionRange, float skin)
+  : radius(radius), stiffness(stiffness), damping(damping), mass(mass), cohesion(cohesion),
+    cohesionRange(cohesionRange), skin(skin), strandCount(0), length(0), awake(nullptr), stale(true),
+    contactCount(0), updateCount(0), rebuildCount(0) {}
+
+void HairCollision::setSkin(float skin) {
+  this->skin = skin;
+  stale = true;
+}
+
+int HairCollision::bucket(int x, int y, int z) const {
+  unsigned h = (unsigned) x * 73856093u ^ (unsigned) y * 19349663u ^ (unsigned) z * 83492791u;
+  return h & (bucketCounts.size() - 1);
+}
+
+void HairCollision::update(const float* state, int strandCount, int length, const char* awake, ThreadPool& pool) {
+  if (strandCount != this->strandCount || length != this->length) {
+    stale = true;
+  }
+  this->strandCount = strandCount;
+  this->length = length;
+  this->awake = awake;
+  accelerations.resize(strandCount * 3 * length);
+  wokenFlags.resize(strandCount);
+  contactCount = 0;
+
+  int perStrand = length - 1;
+  int segments = strandCount * perStrand;
+  if (segments <= 0) {
+    fill(accelerations.begin(), accelerations.end(), 0.0f);
+    fill(wokenFlags.begin(), wokenFlags.end(), 0);
+    return;
+  }
+
+  updateCount++;
+  if (stale || moved(state, pool)) {
+    build(state, pool);
+    rebuildCount++;
+    stale = false;
+  }
+
+  // Forces, a strand at a time so every particle is written by one
+  // thread; each pair is in the lists of both sides.
+  int strandChunks = max(1, min(strandCount, 4 * pool.threadCount()));
+  int strandGrain = (strandCount + strandChunks - 1) / strandChunks;
+  chunkContacts.assign(strandChunks, 0);
+  pool.parallelFor(strandChunks, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      int touches = 0;
+      for (int s = c * strandGrain; s < min(strandCount, (c + 1) * strandGrain); s++) {
+        float* acc = &accelerations[s * 3 * length];
+        fill(acc, acc + 3 * length, 0.0f);
+        bool touchedAwake = false;
+        for (int i = 0; i < perStrand; i++) {
+          interact(state, s, i, acc, touchedAwake, touches);
+        }
+        wokenFlags[s] = awake && !awake[s] && touchedAwake;
+      }
+      chunkContacts[c] = touches;
+    }
+  });
+  for (int c = 0; c < strandChunks; c++) {
+    contactCount += chunkContacts[c];
+  }
+}
+
+bool HairCollision::moved(const float* state, ThreadPool& pool) {
+  int L = length;
+  int particles = strandCount * L;
+  int chunks = (particles + GRAIN - 1) / GRAIN;
+  float limit = 0.5f * skin;
+  chunkMoved.assign(chunks, 0);
+  pool.parallelFor(chunks, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      for (int p = c * GRAIN; p < min(particles, (c + 1) * GRAIN); p++) {
+        const float* x = state + (p / L) * 6 * L + p % L;
+        const float* b = &built[(p / L) * 3 * L + p % L];
+        float d[3] = { x[0] - b[0], x[L] - b[L], x[2 * L] - b[2 * L] };
+        // NaN counts as moved
+        if (!(dot(d, d) <= limit * limit)) {
+          chunkMoved[c] = 1;
+          break;
+        }
+      }
+    }
+  });
+  for (int c = 0; c < chunks; c++) {
+    if (chunkMoved[c]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void HairCollision::build(const float* state, ThreadPool& pool) {
+  int slice = 6 * length;
+  int perStrand = length - 1;
+  int segments = strandCount * perStrand;
+  int chunks = (segments + GRAIN - 1) / GRAIN;
+  // Boxes grow by half the reach of a pair, so boxes overlap for every
+  // pair that could come within it before the next rebuild: each
+  // particle moves less than half the skin until then, so the distance
+  // between two segments shrinks by less than the skin.
+  float grow = radius + 0.5f * (cohesionRange + skin);
+
+  built.resize(strandCount * 3 * length);
+  pool.parallelFor(strandCount, 64, [&](int begin, int end) {
+    for (int s = begin; s < end; s++) {
+      copy(state + s * slice, state + s * slice + 3 * length, &built[s * 3 * length]);
+    }
+  });
+
+  // boxes, and the mean and longest segment for the cell size
+  segmentBoxes.resize(6 * segments);
+  segmentCells.resize(6 * segments);
+  chunkSum.assign(chunks, 0.0f);
+  chunkMax.assign(chunks, 0.0f);
+  pool.parallelFor(chunks, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      float sum = 0, longest = 0;
+      for (int k = c * GRAIN; k < min(segments, (c + 1) * GRAIN); k++) {
+        const float* p = state + (k / perStrand) * slice + k % perStrand;
+        float* box = &segmentBoxes[6 * k];
+        float d[3];
+        for (int a = 0; a < 3; a++) {
+          float p0 = p[a * length], p1 = p[a * length + 1];
+          box[a] = min(p0, p1) - grow;
+          box[3 + a] = max(p0, p1) + grow;
+          d[a] = p1 - p0;
+        }
+        float segmentLength = sqrt(dot(d, d));
+        sum += segmentLength;
+        longest = max(longest, segmentLength);
+      }
+      chunkSum[c] = sum;
+      chunkMax[c] = longest;
+    }
+  });
+  float sum = 0, longest = 0;
+  for (int c = 0; c < chunks; c++) {
+    sum += chunkSum[c];
+    longest = max(longest, chunkMax[c]);
+  }
+  float cellSize = max(sum / segments + 2 * grow, longest / MAX_SPAN);
+  if (!(cellSize > 0 && cellSize < FLT_MAX)) {
+    // the state blew up; any size keeps the hash in one piece
+    cellSize = 1;
+  }
+  float inverseCell = 1 / cellSize;
+
+  // the cells of every segment
+  chunkCells.assign(chunks, 0);
+  pool.parallelFor(chunks, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      int count = 0;
+      for (int k = c * GRAIN; k < min(segments, (c + 1) * GRAIN); k++) {
+        const float* box = &segmentBoxes[6 * k];
+        int* cells = &segmentCells[6 * k];
+        for (int a = 0; a < 3; a++) {
+          cells[a] = cellOf(box[a], inverseCell);
+          // only clips boxes that aren't finite
+          cells[3 + a] = min(cellOf(box[3 + a], inverseCell), cells[a] + MAX_SPAN + 1);
+        }
+        count += (cells[3] - cells[0] + 1) * (cells[4] - cells[1] + 1) * (cells[5] - cells[2] + 1);
+      }
+      chunkCells[c] = count;
+    }
+  });
+  size_t cellCount = 0;
+  for (int c = 0; c < chunks; c++) {
+    cellCount += chunkCells[c];
+  }
+
+  // a table of about two buckets per entry
+  size_t tableSize = 1;
+  while (tableSize < 2 * cellCount) {
+    tableSize *= 2;
+  }
+  if (bucketCounts.size() != tableSize) {
+    vector<atomic<int> > table(tableSize);
+    bucketCounts.swap(table);
+  }
+  int buckets = tableSize;
+  int bucketChunks = (buckets + GRAIN - 1) / GRAIN;
+  bucketStarts.resize(buckets + 1);
+
+  pool.parallelFor(buckets, GRAIN, [&](int begin, int end) {
+    for (int b = begin; b < end; b++) {
+      bucketCounts[b].store(0, memory_order_relaxed);
+    }
+  });
+
+  pool.parallelFor(segments, GRAIN, [&](int begin, int end) {
+    for (int k = begin; k < end; k++) {
+      const int* cells = &segmentCells[6 * k];
+      for (int z = cells[2]; z <= cells[5]; z++) {
+        for (int y = cells[1]; y <= cells[4]; y++) {
+          for (int x = cells[0]; x <= cells[3]; x++) {
+            bucketCounts[bucket(x, y, z)].fetch_add(1, memory_order_relaxed);
+          }
+        }
+      }
+    }
+  });
+
+  // Where each bucket starts: sums per chunk of buckets, then each chunk
+  // from its offset. The counts become the cursors for the scatter.
+  vector<int> chunkStarts(bucketChunks + 1, 0);
+  pool.parallelFor(bucketChunks, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      int count = 0;
+      for (int b = c * GRAIN; b < min(buckets, (c + 1) * GRAIN); b++) {
+        count += bucketCounts[b].load(memory_order_relaxed);
+      }
+      chunkStarts[c + 1] = count;
+    }
+  });
+  for (int c = 0; c < bucketChunks; c++) {
+    chunkStarts[c + 1] += chunkStarts[c];
+  }
+  pool.parallelFor(bucketChunks, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      int start = chunkStarts[c];
+      for (int b = c * GRAIN; b < min(buckets, (c + 1) * GRAIN); b++) {
+        bucketStarts[b] = start;
+        start += bucketCounts[b].load(memory_order_relaxed);
+        bucketCounts[b].store(bucketStarts[b], memory_order_relaxed);
+      }
+    }
+  });
+  bucketStarts[buckets] = cellCount;
+  entries.resize(cellCount);
+
+  // entries carry what the query tests first, so scanning a bucket reads
+  // it front to back
+  pool.parallelFor(segments, GRAIN, [&](int begin, int end) {
+    for (int k = begin; k < end; k++) {
+      const int* cells = &segmentCells[6 * k];
+      Entry entry;
+      entry.segment = k;
+      for (int a = 0; a < 3; a++) {
+        entry.low[a] = cells[a];
+      }
+      copy(&segmentBoxes[6 * k], &segmentBoxes[6 * k] + 6, entry.box);
+      for (int z = cells[2]; z <= cells[5]; z++) {
+        for (int y = cells[1]; y <= cells[4]; y++) {
+          for (int x = cells[0]; x <= cells[3]; x++) {
+            entries[bucketCounts[bucket(x, y, z)].fetch_add(1, memory_order_relaxed)] = entry;
+          }
+        }
+      }
+    }
+  });
+
+  // the scatter filled buckets in whatever order the threads got there,
+  // and the forces are summed in bucket order
+  pool.parallelFor(buckets, GRAIN, [&](int begin, int end) {
+    for (int b = begin; b < end; b++) {
+      if (bucketStarts[b + 1] - bucketStarts[b] > 1) {
+        sort(entries.begin() + bucketStarts[b], entries.begin() + bucketStarts[b + 1],
+             [](const Entry& a, const Entry& b) { return a.segment < b.segment; });
+      }
+    }
+  });
+
+  // The neighbour lists, a strand at a time: every segment of another
+  // strand whose box overlaps and that is within reach, in the order the
+  // hash finds them, then all the lists packed one after the other.
+  int strandChunks = max(1, min(strandCount, 4 * pool.threadCount()));
+  int strandGrain = (strandCount + strandChunks - 1) / strandChunks;
+  chunkNeighbours.resize(strandChunks);
+  neighbourStarts.resize(segments + 1);
+  pool.parallelFor(strandChunks, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      chunkNeighbours[c].clear();
+      for (int k = c * strandGrain * perStrand; k < min(strandCount, (c + 1) * strandGrain) * perStrand; k++) {
+        // the count for now, the start once they are packed
+        neighbourStarts[k] = findNeighbours(state, k, 2 * grow, chunkNeighbours[c]);
+      }
+    }
+  });
+  vector<int> listStarts(strandChunks + 1, 0);
+  for (int c = 0; c < strandChunks; c++) {
+    listStarts[c + 1] = listStarts[c] + chunkNeighbours[c].size();
+  }
+  neighbours.resize(listStarts[strandChunks]);
+  pool.parallelFor(strandChunks, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      int start = listStarts[c];
+      for (int k = c * strandGrain * perStrand; k < min(strandCount, (c + 1) * strandGrain) * perStrand; k++) {
+        int count = neighbourStarts[k];
+        neighbourStarts[k] = start;
+        start += count;
+      }
+      copy(chunkNeighbours[c].begin(), chunkNeighbours[c].end(), neighbours.begin() + listStarts[c]);
+    }
+  });
+  neighbourStarts[segments] = listStarts[strandChunks];
+}
+
+int HairCollision::findNeighbours(const float* state, int k0, float reach, vector<int>& found) const {
+  int L = length;
+  int perStrand = L - 1;
+  int s = k0 / perStrand, i = k0 % perStrand;
+  const float* own = state + s * 6 * L;
+  float p0[3] = { own[i], own[L + i], own[2 * L + i] };
+  float d1[3] = { own[i + 1] - p0[0], own[L + i + 1] - p0[1], own[2 * L + i + 1] - p0[2] };
+  const float* box = &segmentBoxes[6 * k0];
+  const int* cells = &segmentCells[6 * k0];
+  int count = 0;
+
+  for (int z = cells[2]; z <= cells[5]; z++) {
+    for (int y = cells[1]; y <= cells[4]; y++) {
+      for (int x = cells[0]; x <= cells[3]; x++) {
+        int b = bucket(x, y, z);
+        int previous = -1;
+        for (int e = bucketStarts[b]; e < bucketStarts[b + 1]; e++) {
+          // a segment is in a bucket once for each of its cells there
+          const Entry& entry = entries[e];
+          int k = entry.segment;
+          if (k == previous) {
+            continue;
+          }
+          previous = k;
+          int os = k / perStrand;
+          if (os == s) {
+            continue;
+          }
+          // The pair is tested in the cell holding the low corner of
+          // where the boxes overlap, which is the higher of their low
+          // cells, and not at all if they don't.
+          if (max(cells[0], entry.low[0]) != x || max(cells[1], entry.low[1]) != y ||
+              max(cells[2], entry.low[2]) != z) {
+            continue;
+          }
+          const float* otherBox = entry.box;
+          if (max(box[0], otherBox[0]) > min(box[3], otherBox[3]) ||
+              max(box[1], otherBox[1]) > min(box[4], otherBox[4]) ||
+              max(box[2], otherBox[2]) > min(box[5], otherBox[5])) {
+            continue;
+          }
+
+          int j = k % perStrand;
+          const float* other = state + os * 6 * L;
+          float q0[3] = { other[j], other[L + j], other[2 * L + j] };
+          float d2[3] = { other[j + 1] - q0[0], other[L + j + 1] - q0[1], other[2 * L + j + 1] - q0[2] };
+          float r[3] = { p0[0] - q0[0], p0[1] - q0[1], p0[2] - q0[2] };
+          float u, t;
+          closestOnSegments(d1, d2, r, u, t);
+          float delta[3];
+          for (int c = 0; c < 3; c++) {
+            delta[c] = r[c] + u * d1[c] - t * d2[c];
+          }
+          // NaN positions keep their candidates
+          if (dot(delta, delta) >= reach * reach) {
+            continue;
+          }
+          found.push_back(k);
+          count++;
+        }
+      }
+    }
+  }
+  return count;
+}
+
+void HairCollision::interact(const float* state, int s, int i, float* acc, bool& touchedAwake, int& touches) const {
+  int L = length;
+  int perStrand = L - 1;
+  float contact = 2 * radius;
+  float reach = contact + cohesionRange;
+  const float* own = state + s * 6 * L;
+  float p0[3] = { own[i], own[L + i], own[2 * L + i] };
+  float d1[3] = { own[i + 1] - p0[0], own[L + i + 1] - p0[1], own[2 * L + i + 1] - p0[2] };
+  const float* ownVel = own + 3 * L;
+  int k0 = s * perStrand + i;
+
+  for (int n = neighbourStarts[k0]; n < neighbourStarts[k0 + 1]; n++) {
+    int k = neighbours[n];
+    int os = k / perStrand;
+    int j = k % perStrand;
+    const float* other = state + os * 6 * L;
+    float q0[3] = { other[j], other[L + j], other[2 * L + j] };
+    float d2[3] = { other[j + 1] - q0[0], other[L + j + 1] - q0[1], other[2 * L + j + 1] - q0[2] };
+    float r[3] = { p0[0] - q0[0], p0[1] - q0[1], p0[2] - q0[2] };
+    float u, t;
+    closestOnSegments(d1, d2, r, u, t);
+    float delta[3];
+    for (int c = 0; c < 3; c++) {
+      delta[c] = r[c] + u * d1[c] - t * d2[c];
+    }
+    float dist2 = dot(delta, delta);
+    if (!(dist2 < reach * reach) || dist2 == 0) {
+      continue;
+    }
+    touchedAwake = touchedAwake || (awake && awake[os]);
+    float dist = sqrt(dist2);
+    float normal[3] = { delta[0] / dist, delta[1] / dist, delta[2] / dist };
+
+    float force;
+    if (dist < contact) {
+      // penalty along the normal, damped by the approach speed, and
+      // never pulling the capsules together
+      touches++;
+      const float* otherVel = other + 3 * L;
+      float approach = 0;
+      for (int c = 0; c < 3; c++) {
+        float va = ownVel[c * L + i] + u * (ownVel[c * L + i + 1] - ownVel[c * L + i]);
+        float vb = otherVel[c * L + j] + t * (otherVel[c * L + j + 1] - otherVel[c * L + j]);
+        approach += (va - vb) * normal[c];
+      }
+      force = max(0.0f, stiffness * (contact - dist) - damping * approach);
+    } else {
+      // cohesion across the gap, zero at both ends of the range so
+      // nothing jumps as pairs come and go
+      float gap = dist - contact;
+      force = -cohesion * gap * (1 - gap / cohesionRange);
+    }
+    float a = force / mass;
+    for (int c = 0; c < 3; c++) {
+      acc[c * L + i] += (1 - u) * a * normal[c];
+      acc[c * L + i + 1] += u * a * normal[c];
+    }
+  }
+}
@@ -0,0 +1,138 @@
+#ifndef HAIR_SIMULATION_HAIRCOLLISION_H
+#define HAIR_SIMULATION_HAIRCOLLISION_H
+
+#include <atomic>
+#include <vector>
+#include "threadpool.h"
+
+// Repulsion and cohesion between strands, computed for a whole group at
+// once.
+//
+// Every segment between neighbouring particles is a capsule of the
+// strand radius. Two capsules of different strands that overlap push
+// each other apart along the line between their closest points with a
+// damped penalty spring; a little further apart, within the cohesion
+// range, they pull each other together, which clumps hair. Either force
+// is shared between the two particles of each segment by where the
+// closest point lies.
+//
+// Pairs come from Verlet neighbour lists: every segment keeps the
+// segments of other strands within the cohesion range plus a skin, and
+// the lists are only rebuilt once some particle has moved more than
+// half the skin since the last build. Until then no pair outside them
+// can come within range, so a step only tests the pairs in the lists.
+//
+// Rebuilding goes through a spatial hash of a uniform grid, with cells
+// about as wide as the mean segment plus the reach. Every segment is
+// entered in each cell its bounding box, grown by half the reach,
+// overlaps; two segments whose boxes overlap share a cell, and the pair
+// is only tested in the one holding the low corner of the overlap.
+// Building the hash and querying it both run on the thread pool, and
+// the work grows with the number of segments and their neighbours, not
+// with the square of either.
+//
+// The forces are held for a whole step, like the wind, rather than
+// evaluated inside the integrator, so they are explicit whatever the
+// stepper. Results don't depend on the number of threads.
+class HairCollision {
+public:
+  // radius of the capsules, stiffness and damping of the penalty spring
+  // and mass of a particle, which turns forces into accelerations.
+  // cohesion is the stiffness of the pull over cohesionRange beyond
+  // contact, 0 for none; skin is how much further the lists reach.
+  HairCollision(float radius, float stiffness, float damping, float mass,
+                float cohesion, float cohesionRange, float skin);
+
+  // A larger skin rebuilds the lists less often but makes them longer;
+  // 0 rebuilds them whenever anything moves. Takes effect at the next
+  // update, which rebuilds them.
+  void setSkin(float skin);
+
+  // Forces between strandCount strands of length particles each, laid
+  // out like HairGroup::groupState(): x[L] y[L] z[L] vx[L] vy[L] vz[L]
+  // per strand, strand after strand. awake, if not null, has a flag per
+  // strand; see woken().
+  void update(const float* state, int strandCount, int length, const char* awake, ThreadPool& pool);
+
+  // acceleration of each particle of a strand, x[L] y[L] z[L], valid
+  // until the next update with another strand count or length
+  const float* acceleration(int strand) const { return &accelerations[strand * 3 * length]; }
+  // whether a strand not flagged awake touched one that is
+  bool woken(int strand) const { return wokenFlags[strand] != 0; }
+  // pairs of capsules that overlapped in the last update, each counted
+  // from both sides
+  long contacts() const { return contactCount; }
+  // updates since construction, and how many of them rebuilt the lists
+  long updates() const { return updateCount; }
+  long rebuilds() const { return rebuildCount; }
+
+private:
+  // a segment in the hash, with its low cell and box
+  struct Entry {
+    int segment;
+    int low[3];
+    float box[6];
+  };
+
+  HairCollision(const HairCollision&);
+  HairCollision& operator=(const HairCollision&);
+
+  // bucket of a grid cell in the hash table
+  int bucket(int x, int y, int z) const;
+  // whether a particle moved more than half the skin since the build
+  bool moved(const float* state, ThreadPool& pool);
+  // rebuild the hash and the neighbour lists from state
+  void build(const float* state, ThreadPool& pool);
+  // append the segments within reach of segment k, returning how many
+  int findNeighbours(const float* state, int k, float reach, std::vector<int>& found) const;
+  // add the forces of every neighbour within range of segment i of strand s
+  void interact(const float* state, int s, int i, float* acc, bool& touchedAwake, int& touches) const;
+
+  float radius;
+  float stiffness;
+  float damping;
+  float mass;
+  float cohesion;
+  float cohesionRange;
+  float skin;
+
+  int strandCount;
+  int length;
+  const char* awake;
+  // set when the lists must be rebuilt whatever moved
+  bool stale;
+
+  // positions at the last build, x[L] y[L] z[L] per strand
+  std::vector<float> built;
+  // per segment, where its neighbours start in neighbours, and one more
+  // for the end; neighbours are segment indices
+  std::vector<int> neighbourStarts;
+  std::vector<int> neighbours;
+
+  // per segment, strand after strand: its box grown by the radius, low
+  // then high corner, and the range of cells that covers
+  std::vector<float> segmentBoxes;
+  std::vector<int> segmentCells;
+  // table of buckets, a power of two; count, then cursor of each bucket
+  // while entries are filled in
+  std::vector<std::atomic<int> > bucketCounts;
+  std::vector<int> bucketStarts;
+  // segments by bucket, once for each of their cells in it, sorted by
+  // index within each bucket
+  std::vector<Entry> entries;
+  // per chunk of the pool's work, for the reductions
+  std::vector<float> chunkSum;
+  std::vector<float> chunkMax;
+  std::vector<int> chunkCells;
+  std::vector<long> chunkContacts;
+  std::vector<char> chunkMoved;
+  std::vector<std::vector<int> > chunkNeighbours;
+
+  std::vector<float> accelerations;
+  std::vector<char> wokenFlags;
+  long contactCount;
+  long updateCount;
+  long rebuildCount;
+};
+
+#endif //HAIR_SIMULATION_HAIRCOLLISION_H
@@ -3,8 +3,10 @@
 #include "camera.h"
 #include "vertexrecorder.h"
 #include "symhair.h"
+#include "settlecache.h"
 #include <string>
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 
@@ -13,6 +15,41 @@ const int DENSITY_H = 6; // number of hairs each round
 const int DENSITY_V = 4; // number of rounds
 const int DENSITY_SYM = 5; // number of symhairs between two hairs
 const float LAT_OFFSET = 0.05; // more realistic look of top hair
+// the default collider, the head's penalty shell baked into a distance
+// field: how fine the grid is and how far it reaches past the shell.
+// Only particles in or right next to the shell need a distance, and
+// those outside the grid are the cheapest to look up. A mesh collider
+// gives distances out to the same margin.
+const float COLLIDER_CELL = 0.05f;
+const float COLLIDER_MARGIN = 3 * COLLIDER_CELL;
+// Every guide stands for a clump of render hairs, so strands collide
+// with the radius of a clump rather than of a hair. The penalty is
+// softer than the core springs and damped a little along the normal.
+const float CLUMP_R = 0.05f;
+const float CLUMP_K = 50.0f;
+const float CLUMP_DAMPING = 0.05f;
+// Strands a little apart pull together over CLUMP_COHESION_RANGE past
+// contact, gently next to gravity. Neighbour lists reach CLUMP_SKIN
+// further, a few steps' worth of motion, before they're rebuilt.
+const float CLUMP_COHESION = 2.0f;
+const float CLUMP_COHESION_RANGE = 0.05f;
+const float CLUMP_SKIN = 0.1f;
+// The volume grid: cells about a few guides across, velocities blended
+// into the grid's at a rate per second, and the push, per unit of
+// density gradient, out of cells holding more than VOLUME_REST_DENSITY
+// particles.
+const float VOLUME_CELL = 0.5f;
+const float VOLUME_FRICTION = 2.0f;
+const float VOLUME_PRESSURE = 2.0f;
+const float VOLUME_REST_DENSITY = 2.0f;
+// Turbulent wind: eddies about half as strong as the mean and a few
+// guides across, and gusts swinging the mean by half every few seconds.
+const float WIND_TURBULENCE = 0.5f;
+const float WIND_EDDY_SIZE = 0.5f;
+const float WIND_GUSTS = 0.5f;
+const float WIND_GUST_PERIOD = 3.0f;
+// with a falloff it fades from a fan this far upwind of the head's centre
+const float WIND_SOURCE_DISTANCE = 4.0f;
 
 static Vector3f positionFromLatLon(float lat, float lon) {
   float x = HEAD_R * cos(lat) * cos(lon);
@@ -21,27 +58,41 @@ static Vector3f positionFromLatLon(float lat, float lon) {
   return Vector3f(x, y, z);
 }
 
-HairGroup::HairGroup() {
+HairGroup::HairGroup(int threadCount)
+  : pool(threadCount), simdLevel(detectSimdLevel()), strainLimit(0), hairCollisions(false),
+    hairCollision(CLUMP_R, CLUMP_K, CLUMP_DAMPING, M, CLUMP_COHESION, CLUMP_COHESION_RANGE, CLUMP_SKIN), volumeInteraction(false),
+    hairVolume(VOLUME_CELL, VOLUME_FRICTION, VOLUME_PRESSURE, VOLUME_REST_DENSITY), turbulentWind(false),
+    windField(WIND_TURBULENCE, WIND_EDDY_SIZE, WIND_GUSTS, WIND_GUST_PERIOD), windFalloff(0), windTime(0) {
   vector<float> lats;
   vector<float> lons;
 
+  fieldCollider.bakeSphere(HEAD_COLLISION_R, COLLIDER_MARGIN, COLLIDER_CELL);
+  collider = &fieldCollider;
+
+  int slice = HairSystem::sliceSize(HAIR_LENGTH);
+  state.assign(DENSITY_V * DENSITY_H * slice, 0.0f);
+  hairs.reserve(DENSITY_V * DENSITY_H);
+
   for (int i = 0; i < DENSITY_V; i++) {
     for (int j = 0; j < DENSITY_H; j++) {
       float lat = ( M_PI / 2.0f ) / DENSITY_V * (i + 1) - LAT_OFFSET;
       float lon = - M_PI * 2 / 3 + ( M_PI ) / DENSITY_H * j;
 
-      hairs.push_back(HairSystem(positionFromLatLon(lat, lon), HAIR_LENGTH));
+      float* hairState = &state[indexOf(i, j) * slice];
+      hairs.push_back(HairSystem(positionFromLatLon(lat, lon), HAIR_LENGTH, hairState));
+      hairs.back().setCollider(collider);
       lats.push_back(lat);
       lons.push_back(lon);
     }
   }
 
-  // hair interpolation
+  // hair interpolation: every render hair is a fixed blend of up to
+  // MAX_GUIDES guides, collected as one sparse matrix
   for (int i = 0; i < DENSITY_V; i++) {
     for (int j = 0; j < DENSITY_H; j++) {
       if (i != DENSITY_V-1) {
         for (int k = 1; k < DENSITY_SYM; k++) {
-          vector<HairSystem*> follow_hairs{&hairs[indexOf(i, j)], &hairs[indexOf(i+1, j)]};
+          vector<int> follow_hairs{indexOf(i, j), indexOf(i+1, j)};
           float weight_right = (1.0 * k) / DENSITY_SYM;
           vector<float> weights{ 1 - weight_right, weight_right };
 
@@ -49,13 +100,13 @@ HairGroup::HairGroup() {
           float lon = lons[indexOf(i, j)] * ( 1 - weight_right ) + lons[indexOf(i+1, j)] * weight_right;
           Vector3f origin = positionFromLatLon(lat, lon);
 
-          symhairs.push_back(SymHair(origin, follow_hairs, weights));
+          addRenderHair(origin, follow_hairs, weights);
         }
       }
 
       if (j != DENSITY_H-1) {
         for (int k = 1; k < DENSITY_SYM; k++) {
-          vector<HairSystem*> follow_hairs{&hairs[indexOf(i, j)], &hairs[indexOf(i, j+1)]};
+          vector<int> follow_hairs{indexOf(i, j), indexOf(i, j+1)};
           float weight_right = (1.0 * k) / DENSITY_SYM;
           vector<float> weights{ 1 - weight_right, weight_right };
 
@@ -63,18 +114,18 @@ HairGroup::HairGroup() {
           float lon = lons[indexOf(i, j)] * ( 1 - weight_right ) + lons[indexOf(i, j+1)] * weight_right;
           Vector3f origin = positionFromLatLon(lat, lon);
 
-          symhairs.push_back(SymHair(origin, follow_hairs, weights));
+          addRenderHair(origin, follow_hairs, weights);
         }
       }
 
       if (i != DENSITY_V-1 && j != DENSITY_H-1) {
         for (int k1 = 1; k1 < DENSITY_SYM; k1++) {
           for (int k2 = 1; k2 < DENSITY_SYM; k2++) {
-            vector<HairSystem*> follow_hairs{
-              &hairs[indexOf(i, j)],
-              &hairs[indexOf(i, j+1)],
-              &hairs[indexOf(i+1, j)],
-              &hairs[indexOf(i+1, j+1)]
+            vector<int> follow_hairs{
+              indexOf(i, j),
+              indexOf(i, j+1),
+              indexOf(i+1, j),
+              indexOf(i+1, j+1)
             };
             float weight_right_1 = (1.0 * k1) / DENSITY_SYM;
             float weight_right_2 = (1.0 * k1) / DENSITY_SYM;
@@ -96,24 +147,78 @@ HairGroup::HairGroup() {
                         weights[3] * lons[indexOf(i+1, j+1)];
             Vector3f origin = positionFromLatLon(lat, lon);
 
-            symhairs.push_back(SymHair(origin, follow_hairs, weights));
+            addRenderHair(origin, follow_hairs, weights);
           }
         }
       }
     }
   }
 
+  int renderCount = renderRoots.size() / 3;
+  renderPoints.assign(renderCount * 3 * HAIR_LENGTH, 0.0f);
+  symhairs.assign(renderCount, SymHair(HAIR_LENGTH));
+
   windBlowing = false;
   highlightCore = false;
 }
 
+void HairGroup::addRenderHair(Vector3f root, const vector<int>& guides, const vector<float>& weights) {
+  for (int k = 0; k < MAX_GUIDES; k++) {
+    // unused slots blend the first guide with weight 0, so every row
+    // has the same shape and the blend needs no branches
+    bool used = k < guides.size();
+    interpGuides.push_back(used ? guides[k] : guides[0]);
+    interpWeights.push_back(used ? weights[k] : 0.0f);
+  }
+  for (int c = 0; c < 3; c++) {
+    renderRoots.push_back(root[c]);
+  }
+}
+
+void HairGroup::interpolate(const float* frame, float* points) {
+  int count = symhairs.size();
+  int L = HAIR_LENGTH;
+  int slice = HairSystem::sliceSize(L);
+  int grain = max(64, count / (4 * pool.threadCount()));
+  pool.parallelFor(count, grain, [this, frame, points, L, slice](int begin, int end) {
+    for (int r = begin; r < end; r++) {
+      const int* g = &interpGuides[r * MAX_GUIDES];
+      const float* w = &interpWeights[r * MAX_GUIDES];
+      StateView g0(frame + g[0] * slice, L), g1(frame + g[1] * slice, L);
+      StateView g2(frame + g[2] * slice, L), g3(frame + g[3] * slice, L);
+      float* out = points + r * 3 * L;
+
+      for (int c = 0; c < 3; c++) {
+        const float* p0 = g0.positions(c);
+        const float* p1 = g1.positions(c);
+        const float* p2 = g2.positions(c);
+        const float* p3 = g3.positions(c);
+        float* o = out + c * L;
+        // contiguous on both sides, so this loop vectorizes
+        for (int i = 0; i < L; i++) {
+          o[i] = w[0] * p0[i] + w[1] * p1[i] + w[2] * p2[i] + w[3] * p3[i];
+        }
+        // the root stays where it was groomed on the head
+        o[0] = renderRoots[3 * r + c];
+      }
+    }
+  });
+}
+
 void HairGroup::draw(GLProgram& gl, VertexRecorder curveRec, VertexRecorder surfaceRec) {
+  interpolate(&state[0], &renderPoints[0]);
+  draw(gl, curveRec, surfaceRec, &state[0], &renderPoints[0]);
+}
+
+void HairGroup::draw(GLProgram& gl, VertexRecorder curveRec, VertexRecorder surfaceRec,
+                     const float* frame, const float* points) {
+  int slice = HairSystem::sliceSize(HAIR_LENGTH);
   for (int i = 0; i < hairs.size(); i++) {
-    hairs[i].draw(gl, curveRec, surfaceRec);
+    hairs[i].draw(gl, curveRec, surfaceRec, StateView(frame + i * slice, HAIR_LENGTH));
   }
 
   for (int i = 0; i < symhairs.size(); i++) {
-    symhairs[i].draw(gl, curveRec, surfaceRec);
+    symhairs[i].draw(gl, curveRec, surfaceRec, points + i * 3 * HAIR_LENGTH);
   }
 
   gl.enableLighting();
@@ -124,9 +229,356 @@ void HairGroup::draw(GLProgram& gl, VertexRecorder curveRec, VertexRecorder surf
 }
 
 void HairGroup::step(TimeStepper* timeStepper, float h) {
+  if (hairCollisions) {
+    collideHairs();
+  }
+  if (volumeInteraction) {
+    applyVolume(h);
+  }
+  if (turbulentWind || !windVolume.empty()) {
+    blowWind(h);
+  }
+
+  awake.clear();
+  for (int i = 0; i < hairs.size(); i++) {
+    if (!hairs[i].isAsleep()) {
+      awake.push_back(&hairs[i]);
+    }
+  }
+  int count = awake.size();
+
+  // explicit integrators step the strands in SIMD batches, a batch at a time per thread
+  StepMethod method;
+  int width = simdWidth(simdLevel);
+  if (width > 1 && timeStepper->staticMethod(&method)) {
+    int batchCount = (count + width - 1) / width;
+    batches.resize(batchCount);
+    pool.parallelFor(batchCount, 1, [this, timeStepper, method, width, count, h](int begin, int end) {
+      for (int b = begin; b < end; b++) {
+        int first = b * width;
+        int size = min(width, count - first);
+        if (!batches[b].step(&awake[first], size, simdLevel, method, h)) {
+          for (int i = first; i < first + size; i++) {
+            timeStepper->takeStep(awake[i], h);
+          }
+        }
+        for (int i = first; i < first + size; i++) {
+          if (strainLimit > 0) {
+            awake[i]->limitStrain(strainLimit);
+          }
+          awake[i]->updateSleep(h);
+        }
+      }
+    });
+  } else {
+    // strands don't interact, so each one can be stepped on its own thread.
+    // a few chunks per thread keeps the load even when strands cost differently
+    int grain = max(1, count / (4 * pool.threadCount()));
+    pool.parallelFor(count, grain, [this, timeStepper, h](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        timeStepper->takeStep(awake[i], h);
+        if (strainLimit > 0) {
+          awake[i]->limitStrain(strainLimit);
+        }
+        awake[i]->updateSleep(h);
+      }
+    });
+  }
+
+  wakeNeighbours();
+}
+
+void HairGroup::collideHairs() {
+  int count = hairs.size();
+  awakeFlags.resize(count);
+  bool moving = false;
+  for (int i = 0; i < count; i++) {
+    awakeFlags[i] = !hairs[i].isAsleep();
+    moving = moving || awakeFlags[i];
+  }
+  // with every strand asleep the last forces still hold
+  if (!moving) {
+    return;
+  }
+
+  hairCollision.update(&state[0], count, HAIR_LENGTH, &awakeFlags[0], pool);
+  for (int i = 0; i < count; i++) {
+    if (hairCollision.woken(i)) {
+      hairs[i].wake();
+    }
+    hairs[i].setExternalAcceleration(hairCollision.acceleration(i));
+  }
+}
+
+void HairGroup::blowWind(float h) {
+  int count = hairs.size();
+  int L = HAIR_LENGTH;
+  int particles = count * L;
+  if (count == 0) {
+    return;
+  }
+  // every strand feels the same mean wind, the one they blow with anyway
+  Vector3f mean = hairs[0].wind();
+  float meanWind[3] = { mean[0], mean[1], mean[2] };
+  float source[3] = { 0, 0, 0 };
+  float speed = mean.abs();
+  for (int c = 0; c < 3 && speed > 0; c++) {
+    source[c] = -mean[c] / speed * WIND_SOURCE_DISTANCE;
+  }
+  windField.setFalloff(source, windFalloff);
+  windField.setTime(windTime, meanWind);
+  windVolume.setTime(windTime);
+  windTime += h;
+  bool blowing = turbulentWind && mean.absSquared() > 0;
+  bool volume = !windVolume.empty();
+  // the hair feels the volume's air through its drag
+  const float airDrag = K_DRAG / M;
+
+  // The fields are sampled for a chunk of strands at a time, gathered
+  // into x, y and z runs. The strands already apply the mean, so they get
+  // the difference, weighted along them the same way, plus the air of
+  // the volume and the collisions.
+  windSamples.resize(9 * particles);
+  externalForces.resize(3 * particles);
+  pool.parallelFor(count, 64, [&](int begin, int end) {
+    int first = begin * L, n = (end - begin) * L;
+    float* points[3] = { &windSamples[first], &windSamples[particles + first], &windSamples[2 * particles + first] };
+    float* wind[3] = { &windSamples[3 * particles + first], &windSamples[4 * particles + first],
+                       &windSamples[5 * particles + first] };
+    float* air[3] = { &windSamples[6 * particles + first], &windSamples[7 * particles + first],
+                      &windSamples[8 * particles + first] };
+    for (int s = begin; s < end; s++) {
+      const float* x = &state[s * HairSystem::sliceSize(L)];
+      for (int c = 0; c < 3; c++) {
+        copy(x + c * L, x + (c + 1) * L, points[c] + (s - begin) * L);
+      }
+    }
+    if (blowing) {
+      windField.sample(simdLevel, n, points[0], points[1], points[2], wind[0], wind[1], wind[2]);
+    }
+    if (volume) {
+      windVolume.sample(n, points[0], points[1], points[2], air[0], air[1], air[2]);
+    }
+    for (int s = begin; s < end; s++) {
+      float* acc = &externalForces[s * 3 * L];
+      const float* contact = hairCollisions ? hairCollision.acceleration(s) : nullptr;
+      for (int c = 0; c < 3; c++) {
+        const float* w = wind[c] + (s - begin) * L;
+        const float* a = air[c] + (s - begin) * L;
+        for (int i = 0; i < L; i++) {
+          acc[c * L + i] = blowing ? HairSystem::windWeight(i, L) * (w[i] - meanWind[c]) : 0;
+          if (volume) {
+            acc[c * L + i] += airDrag * a[i];
+          }
+          if (contact) {
+            acc[c * L + i] += contact[c * L + i];
+          }
+        }
+      }
+      // gusts and the volume's frames never let the strands settle
+      if (blowing || volume) {
+        hairs[s].wake();
+      }
+      hairs[s].setExternalAcceleration(acc);
+    }
+  });
+}
+
+void HairGroup::applyVolume(float h) {
+  int count = hairs.size();
+  int L = HAIR_LENGTH;
+  movableFlags.resize(count * L);
+  bool moving = false;
+  for (int s = 0; s < count; s++) {
+    bool awake = !hairs[s].isAsleep();
+    moving = moving || awake;
+    for (int i = 0; i < L; i++) {
+      movableFlags[s * L + i] = awake && !hairs[s].isPinned(i);
+    }
+  }
+  if (!moving) {
+    return;
+  }
+
+  unsmoothed = state;
+  hairVolume.apply(&state[0], count, L, &movableFlags[0], h, pool);
+  int slice = HairSystem::sliceSize(L);
+  for (int s = 0; s < count; s++) {
+    if (!hairs[s].isAsleep()) {
+      // drag no longer matches the velocities velocity Verlet carried
+      hairs[s].velocitiesChanged(&unsmoothed[s * slice + 3 * L]);
+    }
+  }
+}
+
+void HairGroup::wakeNeighbours() {
+  for (int i = 0; i < DENSITY_V; i++) {
+    for (int j = 0; j < DENSITY_H; j++) {
+      HairSystem& hair = hairs[indexOf(i, j)];
+      if (hair.isAsleep() || hair.speed() < WAKE_SPEED) {
+        continue;
+      }
+      if (i > 0) {
+        hairs[indexOf(i - 1, j)].wake();
+      }
+      if (i < DENSITY_V - 1) {
+        hairs[indexOf(i + 1, j)].wake();
+      }
+      if (j > 0) {
+        hairs[indexOf(i, j - 1)].wake();
+      }
+      if (j < DENSITY_H - 1) {
+        hairs[indexOf(i, j + 1)].wake();
+      }
+    }
+  }
+}
+
+int HairGroup::awakeCount() const {
+  int count = 0;
+  for (int i = 0; i < hairs.size(); i++) {
+    if (!hairs[i].isAsleep()) {
+      count++;
+    }
+  }
+  return count;
+}
+
+void HairGroup::wakeAll() {
+  for (int i = 0; i < hairs.size(); i++) {
+    hairs[i].wake();
+  }
+}
+
+bool HairGroup::loadCollider(const string& path) {
+  bool mesh = path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0;
+  if (mesh ? !meshCollider.load(path, COLLIDER_MARGIN) : !fieldCollider.load(path)) {
+    return false;
+  }
+  collider = mesh ? (const Collider*) &meshCollider : &fieldCollider;
+  for (int i = 0; i < hairs.size(); i++) {
+    hairs[i].setCollider(collider);
+  }
+  return true;
+}
+
+void HairGroup::setStrainLimit(float maxStretch) {
+  strainLimit = max(0.0f, maxStretch);
+}
+
+void HairGroup::setHairCollision(bool on) {
+  if (on == hairCollisions) {
+    return;
+  }
+  hairCollisions = on;
+  // the forces come back at the next step
+  for (int i = 0; i < hairs.size(); i++) {
+    hairs[i].setExternalAcceleration(nullptr);
+  }
+  wakeAll();
+}
+
+void HairGroup::setNeighbourSkin(float skin) {
+  hairCollision.setSkin(max(0.0f, skin));
+}
+
+bool HairGroup::loadWindVolume(const string& path) {
+  bool loaded = true;
+  if (path.empty()) {
+    windVolume.close();
+  } else {
+    loaded = windVolume.load(path);
+  }
+  // play it from the start; without one only the turbulence is left
+  windTime = 0;
   for (int i = 0; i < hairs.size(); i++) {
-    timeStepper->takeStep(&hairs[i], h);
+    hairs[i].setExternalAcceleration(nullptr);
   }
+  wakeAll();
+  return loaded;
+}
+
+void HairGroup::setTurbulentWind(bool on) {
+  if (on == turbulentWind) {
+    return;
+  }
+  turbulentWind = on;
+  // the collisions alone come back at the next step
+  for (int i = 0; i < hairs.size(); i++) {
+    hairs[i].setExternalAcceleration(nullptr);
+  }
+  wakeAll();
+}
+
+void HairGroup::setWindFalloff(float radius) {
+  windFalloff = max(0.0f, radius);
+}
+
+void HairGroup::setHairVolume(bool on) {
+  if (on != volumeInteraction) {
+    volumeInteraction = on;
+    wakeAll();
+  }
+}
+
+long HairGroup::strainChecks() const {
+  long count = 0;
+  for (int i = 0; i < hairs.size(); i++) {
+    count += hairs[i].strainChecks();
+  }
+  return count;
+}
+
+long HairGroup::strainClamps() const {
+  long count = 0;
+  for (int i = 0; i < hairs.size(); i++) {
+    count += hairs[i].strainClamps();
+  }
+  return count;
+}
+
+int HairGroup::settle(const string& cachePath) {
+  int count = hairs.size();
+  uint64_t key = settleKey();
+  int settledCount;
+  if (!cachePath.empty() && readSettleCache(cachePath, key, &state[0], state.size(), &settledCount)) {
+    for (int i = 0; i < count; i++) {
+      hairs[i].startAtRest();
+    }
+    return settledCount;
+  }
+
+  vector<char> settled(count, 0);
+  pool.parallelFor(count, 1, [this, &settled](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      settled[i] = hairs[i].settle();
+    }
+  });
+  // the solve is deterministic, so strands it left short of rest are
+  // cached as they are too
+  settledCount = std::count(settled.begin(), settled.end(), 1);
+  if (!cachePath.empty()) {
+    writeSettleCache(cachePath, key, &state[0], state.size(), settledCount);
+  }
+  return settledCount;
+}
+
+uint64_t HairGroup::settleKey() const {
+  int layout[3] = { DENSITY_V, DENSITY_H, HAIR_LENGTH };
+  uint64_t key = hashBytes(layout, sizeof(layout));
+  for (int i = 0; i < hairs.size(); i++) {
+    key = hairs[i].settleKey(key);
+  }
+  return collider->hash(key);
+}
+
+void HairGroup::setThreadCount(int threadCount) {
+  pool.setThreadCount(threadCount);
+}
+
+void HairGroup::setSimdLevel(SimdLevel level) {
+  simdLevel = min(level, detectSimdLevel());
+  fieldCollider.setSimdLevel(simdLevel);
 }
 
 int HairGroup::indexOf(int h, int w) {
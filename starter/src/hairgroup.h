@@ -1,19 +1,36 @@
 #ifndef HAIR_SIMULATION_HAIRGROUP_H
 #define HAIR_SIMULATION_HAIRGROUP_H
 
+#include <string>
 #include "hairsystem.h"
+#include "distancefield.h"
+#include "meshcollider.h"
+#include "haircollision.h"
+#include "hairvolume.h"
+#include "windfield.h"
+#include "windvolume.h"
 #include "symhair.h"
 #include "timestepper.h"
+#include "threadpool.h"
+#include "strandbatch.h"
 static int HAIR_LENGTH = 16;
+// most guides a render hair is blended from
+const int MAX_GUIDES = 4;
 
 class HairGroup {
 public:
-  HairGroup();
+  HairGroup(int threadCount = 0);
 
+  // every strand is a view into its slice of state
   std::vector<HairSystem> hairs;
   std::vector<SymHair> symhairs;
 
+  // draw the current state
   void draw(GLProgram& ctx, VertexRecorder curveRec, VertexRecorder surfaceRec);
+  // draw a copy of the state, laid out like groupState(), with the
+  // render hairs interpolate() blended from it
+  void draw(GLProgram& ctx, VertexRecorder curveRec, VertexRecorder surfaceRec,
+            const float* frame, const float* points);
   void step(TimeStepper* timeStepper, float h);
   void setHairCurve(float l_input);
   void toggleWind();
@@ -21,12 +38,150 @@ public:
   void setWindStrength(float strength);
   void setWindDirection(float index);
   void setHairColor(float r, float g, float b);
+  // number of threads stepping the strands, 0 = one per core, 1 = serial
+  void setThreadCount(int threadCount);
+  // instruction set for stepping strands in batches and for the wind and
+  // distance field lookups, capped at what the CPU supports; SIMD_SCALAR
+  // steps strands one by one
+  void setSimdLevel(SimdLevel level);
+
+  // strands settle and fall asleep when nothing moves them (see
+  // HairSystem::updateSleep); step() only integrates the awake ones
+  int awakeCount() const;
+  // for changes the strands can't see themselves, like a moving collider
+  void wakeAll();
+
+  // Collide with the shape stored at path instead of the head sphere: a
+  // triangle mesh if it ends in .obj (see MeshCollider), a distance
+  // field otherwise. Returns false, keeping the current one, if it
+  // can't be read. Not while another thread steps the group.
+  bool loadCollider(const std::string& path);
+
+  // Clamp core spring stretch to maxStretch after every step (see
+  // HairSystem::limitStrain), so larger steps stay presentable; 0 is off
+  void setStrainLimit(float maxStretch);
+  // Push strands apart where they overlap (see HairCollision), with
+  // forces found at the start of every step; off by default
+  void setHairCollision(bool on);
+  // overlapping pairs of strand segments at the last step, counted
+  // from both sides
+  long hairContacts() const { return hairCollisions ? hairCollision.contacts() : 0; }
+  // how much further than the cohesion range the neighbour lists of
+  // setHairCollision reach; larger rebuilds them less often
+  void setNeighbourSkin(float skin);
+  // steps that found forces between strands, and how many of them had
+  // to rebuild the neighbour lists, since the start
+  long neighbourUpdates() const { return hairCollision.updates(); }
+  long neighbourRebuilds() const { return hairCollision.rebuilds(); }
+  // Correct velocities through a grid over the whole group before every
+  // step (see HairVolume), for volume and coherent motion at a fixed
+  // cost per particle; off by default
+  void setHairVolume(bool on);
+  // Blow gusts and eddies around the mean wind (see WindField), sampled
+  // at every particle before every step; off by default
+  void setTurbulentWind(bool on);
+  // Fade the turbulent wind to half at radius from a fan upwind of the
+  // head (see WindField::setFalloff); 0, the default, is no falloff
+  void setWindFalloff(float radius);
+  // Blow the air of the wind volume at path (see WindVolume) through the
+  // hair as well, from its first frame; an empty path stops it. Returns
+  // false, leaving no volume, if it can't be read. Not while another
+  // thread steps the group.
+  bool loadWindVolume(const std::string& path);
+  // core springs checked and clamped by the strain limit, over all
+  // strands since the start; their ratio says how hard h leans on it
+  long strainChecks() const;
+  long strainClamps() const;
+  // Put every strand straight into its rest pose (HairSystem::settle)
+  // instead of letting it fall there; returns how many got there. The
+  // pose is solved for, and keyed on, the curvature and wind set now, so
+  // set those first. With a cache path, a pose cached there for the same
+  // groom is loaded instead of solved for, and a newly solved one is
+  // written there.
+  int settle(const std::string& cachePath = "");
+  // hash of everything the rest pose depends on, the settle cache key
+  uint64_t settleKey() const;
+
+  // positions and velocities of every guide, strand after strand
+  const std::vector<float>& groupState() const { return state; }
+  // Blend the render hairs from a guide state laid out like groupState()
+  // into points: x[L] y[L] z[L] per render hair, one after the other,
+  // renderPointsSize() floats in all. Runs on the group's threads.
+  void interpolate(const float* frame, float* points);
+  int renderPointsSize() const { return renderPoints.size(); }
 
   bool windBlowing;
   bool highlightCore;
 
 private:
   int indexOf(int h, int w);
+  // add a row to the interpolation matrix: a render hair rooted at root
+  // that follows up to MAX_GUIDES guides with the given weights
+  void addRenderHair(Vector3f root, const std::vector<int>& guides, const std::vector<float>& weights);
+  // wake the grid neighbours of strands that are moving
+  void wakeNeighbours();
+  // forces between the strands for the coming step, and wake the
+  // sleeping ones an awake one runs into
+  void collideHairs();
+  // the HairVolume correction of the awake strands for a step of h
+  void applyVolume(float h);
+  // the turbulent wind and the wind volume for a step of h, added to
+  // the collision forces
+  void blowWind(float h);
+
+  // positions and velocities of all strands in one allocation, strand
+  // after strand. Sized once in the constructor and never reallocated,
+  // since the strands point into it.
+  std::vector<float> state;
+
+  // what the strands collide with, one of the shapes below; they point
+  // at it
+  const Collider* collider;
+  DistanceField fieldCollider;
+  MeshCollider meshCollider;
+
+  // workers for step(), kept alive across frames
+  ThreadPool pool;
+
+  SimdLevel simdLevel;
+  // see setStrainLimit, 0 = off
+  float strainLimit;
+  // see setHairCollision
+  bool hairCollisions;
+  HairCollision hairCollision;
+  // which strands were awake for hairCollision, a flag per strand
+  std::vector<char> awakeFlags;
+  // see setHairVolume
+  bool volumeInteraction;
+  HairVolume hairVolume;
+  // which particles hairVolume corrects, a flag per particle, and the
+  // state before it did
+  std::vector<char> movableFlags;
+  std::vector<float> unsmoothed;
+  // see setTurbulentWind and loadWindVolume, and the seconds they have
+  // blown for, in double so the steps keep adding up in long runs
+  bool turbulentWind;
+  float windFalloff;
+  WindField windField;
+  WindVolume windVolume;
+  double windTime;
+  // positions, then the turbulent wind and the volume's air there, x y z
+  // runs over all particles
+  std::vector<float> windSamples;
+  // what the strands get with either wind on, x[L] y[L] z[L] per strand
+  std::vector<float> externalForces;
+  // one per group of simdWidth(simdLevel) strands, kept for their buffers
+  std::vector<StrandBatch> batches;
+  // the strands step() integrates this time, rebuilt every step
+  std::vector<HairSystem*> awake;
+
+  // Render hairs as a sparse matrix over the guides, MAX_GUIDES entries
+  // per row: guide indices, weights, and the root on the head (xyz).
+  std::vector<int> interpGuides;
+  std::vector<float> interpWeights;
+  std::vector<float> renderRoots;
+  // render hair control points for drawing the current state
+  std::vector<float> renderPoints;
 };
 
 #endif //HAIR_SIMULATION_HAIRGROUP_H
@@ -0,0 +1,152 @@
+#ifndef HAIR_SIMULATION_HAIRSTRAND_H
+#define HAIR_SIMULATION_HAIRSTRAND_H
+
+#include <array>
+#include <cmath>
+#include <vecmath.h>
+#include "collider.h"
+
+// Force kernels for a strand whose length N is known at compile time.
+//
+// Every strand built by HairSystem has the same springs: particle i is
+// tied to i+1 (core), i+2 and i+3 (support), each family with one rest
+// length and one stiffness. With N fixed the spring loops have constant
+// trip counts and are unrolled completely, indices are plain integers
+// instead of floats read from the spring list, and the working set lives
+// in std::array on the stack.
+//
+// The arithmetic is done in the same order as the generic spring-list
+// path in HairSystem, so both give the same results.
+
+// per-strand parameters of the kernel
+struct StrandForces {
+  // springs from i to i+1, i+2, i+3
+  float restLength[3];
+  float stiffness[3];
+  float gravity;
+  float drag;
+  float mass;
+  // magnitude of the push out of the collider
+  float collision;
+  // wind force on the lower half, doubled on the last quarter
+  float wind[3];
+  // null for none, and a hint per particle for it (see Collider::query);
+  // last, so the floats before them can be hashed
+  const Collider* collider;
+  int* contactHints;
+  // acceleration from outside the strand, x[N] y[N] z[N], or null
+  const float* external;
+};
+
+template <int I, int END>
+struct Unroll {
+  template <class F>
+  static inline void run(F& f) {
+    f(I);
+    Unroll<I + 1, END>::run(f);
+  }
+};
+
+template <int END>
+struct Unroll<END, END> {
+  template <class F>
+  static inline void run(F&) {}
+};
+
+template <int N>
+struct HairStrand {
+  typedef std::array<float, N> Array;
+
+  // pos, vel and acc in the x[N] y[N] z[N] layout
+  static void evalAcceleration(const float* pos, const float* vel, float* acc, const StrandForces& p) {
+    Array x, y, z, ax, ay, az;
+    for (int i = 0; i < N; i++) {
+      x[i] = pos[i];
+      y[i] = pos[N + i];
+      z[i] = pos[2 * N + i];
+    }
+
+    // where the particles are in the collider, all of them at once
+    Array d, nx, ny, nz;
+    if (p.collider) {
+      p.collider->query(N, &x[0], &y[0], &z[0], &d[0], &nx[0], &ny[0], &nz[0], p.contactHints);
+    }
+
+    // gravity, drag, collision, wind and anything external
+    for (int i = 0; i < N; i++) {
+      float vx = vel[i], vy = vel[N + i], vz = vel[2 * N + i];
+      float fx = vx * -p.drag / p.mass;
+      float fy = -p.gravity + vy * -p.drag / p.mass;
+      float fz = vz * -p.drag / p.mass;
+
+      if (p.collider && d[i] < 0) {
+        fx += nx[i] * p.collision;
+        fy += ny[i] * p.collision;
+        fz += nz[i] * p.collision;
+      }
+
+      if (i > N / 2) {
+        float w = i > N * 3 / 4 ? 2.0f : 1.0f;
+        fx += p.wind[0] * w;
+        fy += p.wind[1] * w;
+        fz += p.wind[2] * w;
+      }
+
+      if (p.external) {
+        fx += p.external[i];
+        fy += p.external[N + i];
+        fz += p.external[2 * N + i];
+      }
+      ax[i] = fx;
+      ay[i] = fy;
+      az[i] = fz;
+    }
+
+    // the three spring families, in the order of the spring list
+    SpringFamily<1> core = { x, y, z, ax, ay, az, p.restLength[0], p.stiffness[0], p.mass };
+    Unroll<0, N - 1>::run(core);
+    SpringFamily<2> support = { x, y, z, ax, ay, az, p.restLength[1], p.stiffness[1], p.mass };
+    Unroll<0, N - 2>::run(support);
+    SpringFamily<3> bend = { x, y, z, ax, ay, az, p.restLength[2], p.stiffness[2], p.mass };
+    Unroll<0, N - 3>::run(bend);
+
+    for (int i = 0; i < N; i++) {
+      acc[i] = ax[i];
+      acc[N + i] = ay[i];
+      acc[2 * N + i] = az[i];
+    }
+  }
+
+private:
+  // one spring from i to i + STRIDE, called for every i by Unroll
+  template <int STRIDE>
+  struct SpringFamily {
+    const Array& x;
+    const Array& y;
+    const Array& z;
+    Array& ax;
+    Array& ay;
+    Array& az;
+    float restLength;
+    float stiffness;
+    float mass;
+
+    inline void operator()(int i) {
+      int j = i + STRIDE;
+      float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+      float len = std::sqrt(dx * dx + dy * dy + dz * dz);
+      float s = -stiffness * (len - restLength);
+      float fx = dx / len * s / mass;
+      float fy = dy / len * s / mass;
+      float fz = dz / len * s / mass;
+      ax[i] += fx;
+      ay[i] += fy;
+      az[i] += fz;
+      ax[j] -= fx;
+      ay[j] -= fy;
+      az[j] -= fz;
+    }
+  };
+};
+
+#endif //HAIR_SIMULATION_HAIRSTRAND_H
@@ -2,24 +2,82 @@
 #include "camera.h"
 #include "curve.h"
 #include "surf.h"
+#include "bandedmatrix.h"
+#include "integrators.h"
+#include "settlecache.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
 #include <string>
 #include <iostream>
 
 using namespace std;
 
-static Vector3f headCollisionForce(Vector3f point) {
-  float length = point.abs();
-  if ( length < 1.07) {
-    float forceAbs = COLLISION_RES;
-    return forceAbs * point.normalized();
-  } else {
-    return Vector3f::ZERO;
+namespace {
+  // A strand of N particles as seen by the integrator templates. All
+  // calls are non-virtual and the force kernel is inlined into them.
+  template <int N>
+  class StrandSystem {
+  public:
+    StrandSystem(ParticleSystem& system, const StrandForces& forces, const vector<int>& fixed)
+      : system(system), forces(forces), fixed(fixed) {}
+
+    size_t stateSize() const { return 6 * N; }
+    size_t positionSize() const { return 3 * N; }
+    float* state() { return system.state(); }
+    float* scratch(size_t n) { return system.scratch(n); }
+    bool accelerationValid() const { return system.accelerationValid(); }
+    void setAccelerationValid(bool valid) { system.setAccelerationValid(valid); }
+
+    void evalAcceleration(const float* x, const float* v, float* a) {
+      HairStrand<N>::evalAcceleration(x, v, a, forces);
+      for (size_t i = 0; i < fixed.size(); i++) {
+        a[fixed[i]] = a[N + fixed[i]] = a[2 * N + fixed[i]] = 0;
+      }
+    }
+
+    void evalF(const float* in, float* out, size_t n) {
+      for (int i = 0; i < 3 * N; i++) {
+        out[i] = in[3 * N + i];
+      }
+      evalAcceleration(in, in + 3 * N, out + 3 * N);
+    }
+
+  private:
+    ParticleSystem& system;
+    StrandForces forces;
+    const vector<int>& fixed;
+  };
+
+  template <int N>
+  void strandStep(ParticleSystem& system, const StrandForces& forces, const vector<int>& fixed,
+                  StepMethod method, float stepSize) {
+    StrandSystem<N> strand(system, forces, fixed);
+    staticStep(strand, method, stepSize);
   }
+
+  // The static solve and position-based steps see the collider as a
+  // surface SURFACE_GAP outside the penalty shell, so the dynamics start
+  // without any push. In the static solve, particles within CONTACT_SLACK
+  // of it count as resting on it and are held there with
+  // CONTACT_STIFFNESS (per unit mass).
+  const float SURFACE_GAP = 1e-4f;
+  const int PROJECTION_STEPS = 4;
+  const float CONTACT_SLACK = 1e-3f;
+  const float CONTACT_STIFFNESS = 100 * CORE_K / M;
+  // added to the spring Hessian so slack strands still get a step
+  const float SETTLE_REGULARIZATION = 1.0f;
 }
 
-HairSystem::HairSystem(Vector3f origin, int length)
+HairSystem::HairSystem(Vector3f origin, int length, float* state)
 {
   H = length;
+  m_state = state;
+  collider = nullptr;
+  contactHints.assign(H, -1);
+  external = nullptr;
+  carriedExternal.assign(3 * H, 0);
+  m_numParticles = H;
 
   for (int i = 0; i < H; i++) {
     Vector3f sub_origin;
@@ -28,8 +86,10 @@ HairSystem::HairSystem(Vector3f origin, int length)
     } else {
       sub_origin = origin + Vector3f(pow(-1, i) * HORI_DELTA, i*UNIT_H, -pow(-1, i) * VERTI_DELTA);
     }
-    m_vVecState.push_back(sub_origin);
-    m_vVecState.push_back(Vector3f::ZERO);
+    for (int c = 0; c < 3; c++) {
+      m_state[c * H + i] = sub_origin[c];
+      m_state[(3 + c) * H + i] = 0;
+    }
   }
 
   // core springs
@@ -47,6 +107,19 @@ HairSystem::HairSystem(Vector3f origin, int length)
   }
   fixedPtIndex.push_back(0);
 
+  // for position-based integration the core springs are inextensible
+  // and the support springs PBD_SUPPORT_SOFTNESS times more compliant
+  // than their stiffness, see there. The core springs come first, from
+  // the root down, so they form the chain follow-the-leader passes along.
+  for (int i = 0; i < springs.size(); i++) {
+    DistanceConstraint c;
+    c.i = (int) springs[i][0];
+    c.j = (int) springs[i][1];
+    c.restLength = springs[i][2];
+    c.compliance = i < H - 1 ? 0 : PBD_SUPPORT_SOFTNESS * M / springs[i][3];
+    constraints.push_back(c);
+  }
+
   // wind
   windBlowing = true;
   windDirection = Vector3f(0,0,1);
@@ -55,18 +128,110 @@ HairSystem::HairSystem(Vector3f origin, int length)
   hairColor = Vector3f(0.642589, 0.347272, 0.211211);
   tempColor = hairColor;
   highlightCore = false;
+
+  asleep = false;
+  windowTime = 0;
+  lastSpeed = 0;
+  windowStart.resize(sliceSize(H));
+  checkedSprings = 0;
+  clampedSprings = 0;
 }
 
-std::vector<Vector3f> HairSystem::evalF(std::vector<Vector3f> state)
+void HairSystem::evalAcceleration(const float* pos, const float* vel, float* acc)
 {
-  std::vector<Vector3f> f;
+  // common lengths get a kernel compiled for exactly that many particles
+  switch (H) {
+    case 8:
+      HairStrand<8>::evalAcceleration(pos, vel, acc, strandForces());
+      break;
+    case 16:
+      HairStrand<16>::evalAcceleration(pos, vel, acc, strandForces());
+      break;
+    case 32:
+      HairStrand<32>::evalAcceleration(pos, vel, acc, strandForces());
+      break;
+    case 64:
+      HairStrand<64>::evalAcceleration(pos, vel, acc, strandForces());
+      break;
+    default:
+      evalAccelerationGeneric(pos, vel, acc);
+      break;
+  }
+
+  // fixed points don't accelerate, and since they start at rest
+  // their velocity, the derivative of their position, stays zero too
+  for (int i = 0; i < fixedPtIndex.size(); i++) {
+    for (int c = 0; c < 3; c++) {
+      acc[c * H + fixedPtIndex[i]] = 0;
+    }
+  }
+}
+
+bool HairSystem::takeStaticStep(StepMethod method, float stepSize)
+{
+  switch (H) {
+    case 8:
+      strandStep<8>(*this, strandForces(), fixedPtIndex, method, stepSize);
+      return true;
+    case 16:
+      strandStep<16>(*this, strandForces(), fixedPtIndex, method, stepSize);
+      return true;
+    case 32:
+      strandStep<32>(*this, strandForces(), fixedPtIndex, method, stepSize);
+      return true;
+    case 64:
+      strandStep<64>(*this, strandForces(), fixedPtIndex, method, stepSize);
+      return true;
+    default:
+      return false;
+  }
+}
+
+StrandForces HairSystem::strandForces() const
+{
+  // springs are listed family by family: H-1 core springs first,
+  // then H-2 to i+2 and H-3 to i+3, each family sharing its constants
+  int first[3] = { 0, H - 1, 2 * H - 3 };
+  StrandForces p;
+  for (int f = 0; f < 3; f++) {
+    p.restLength[f] = springs[first[f]][2];
+    p.stiffness[f] = springs[first[f]][3];
+  }
+  p.gravity = GRAVITY;
+  p.drag = K_DRAG;
+  p.mass = M;
+  p.collider = collider;
+  p.contactHints = contactHints.empty() ? nullptr : &contactHints[0];
+  p.collision = COLLISION_RES;
+  for (int c = 0; c < 3; c++) {
+    p.wind[c] = windStrength > 0 ? windDirection[c] * windStrength : 0;
+  }
+  p.external = external;
+  return p;
+}
+
+void HairSystem::evalAccelerationGeneric(const float* pos, const float* vel, float* acc)
+{
+  const float* x = pos;
+  const float* y = pos + H;
+  const float* z = pos + 2 * H;
+  const float* vx = vel;
+  const float* vy = vel + H;
+  const float* vz = vel + 2 * H;
+  float* ax = acc;
+  float* ay = acc + H;
+  float* az = acc + 2 * H;
 
   // gravity and drag for structural points
   for (int i = 0; i < H; i++) {
-    f.push_back(state[2 * i + 1]);
+    Vector3f velocity(vx[i], vy[i], vz[i]);
     Vector3f gravity(0.0, -GRAVITY, 0.0);
-    Vector3f drag = -K_DRAG * state[2 * i + 1] / M;
-    Vector3f collision = headCollisionForce(state[2 * i]);
+    Vector3f drag = -K_DRAG * velocity / M;
+    Vector3f collision = Vector3f::ZERO;
+    Vector3f normal;
+    if (collider && collider->distance(Vector3f(x[i], y[i], z[i]), &normal, &contactHints[i]) < 0) {
+      collision = COLLISION_RES * normal;
+    }
     Vector3f windForce = Vector3f::ZERO;
 
     if (windStrength > 0 && i > H / 2) {
@@ -78,7 +243,13 @@ std::vector<Vector3f> HairSystem::evalF(std::vector<Vector3f> state)
       }
     }
 
-    f.push_back(gravity + drag + collision + windForce);
+    Vector3f a = gravity + drag + collision + windForce;
+    if (external) {
+      a += Vector3f(external[i], external[H + i], external[2 * H + i]);
+    }
+    ax[i] = a[0];
+    ay[i] = a[1];
+    az[i] = a[2];
   }
 
   // springs
@@ -88,29 +259,114 @@ std::vector<Vector3f> HairSystem::evalF(std::vector<Vector3f> state)
     int ind1 = (int) springs[i][0];
     int ind2 = (int) springs[i][1];
     // d and ||d|| in the formula
-    Vector3f d = state[2 * ind1] - state[2 * ind2];
+    Vector3f d(x[ind1] - x[ind2], y[ind1] - y[ind2], z[ind1] - z[ind2]);
     Vector3f spring_force = - stiff * (d.abs() - restLen) * d.normalized();
-    f[2 * ind1 + 1] += spring_force / M;
-    f[2 * ind2 + 1] -= spring_force / M;
+    Vector3f a = spring_force / M;
+    ax[ind1] += a[0];
+    ay[ind1] += a[1];
+    az[ind1] += a[2];
+    ax[ind2] -= a[0];
+    ay[ind2] -= a[1];
+    az[ind2] -= a[2];
   }
+}
 
-  for (int i = 0; i < fixedPtIndex.size(); i++) {
-    f[2 * fixedPtIndex[i]] = Vector3f::ZERO;
-    f[2 * fixedPtIndex[i] + 1] = Vector3f::ZERO;
+int HairSystem::jacobianBandwidth() const
+{
+  int bandwidth = 0;
+  for (int i = 0; i < springs.size(); i++) {
+    bandwidth = max(bandwidth, (int) fabs(springs[i][1] - springs[i][0]));
   }
-  return f;
+  return bandwidth;
+}
+
+float HairSystem::evalJacobian(const float* in, BandedBlockMatrix& dadx)
+{
+  // Gravity and wind are constant and the head push is left explicit,
+  // so only the springs contribute to da/dx.
+  addSpringJacobian(in, dadx, true);
+
+  // linear drag: da/dv = -K_DRAG / M
+  return K_DRAG / M;
 }
 
-void HairSystem::draw(GLProgram& gl, VertexRecorder curveRec, VertexRecorder surfaceRec)
+void HairSystem::addSpringJacobian(const float* in, BandedBlockMatrix& dadx, bool clampCompressed) const
+{
+  const float* x = in;
+  const float* y = in + H;
+  const float* z = in + 2 * H;
+
+  // For a spring along u with length l and rest length L:
+  //   dF1/dx1 = -k ( (1 - L/l) (I - u u^T) + u u^T )
+  // Clamping the (1 - L/l) term at zero for compressed springs keeps the
+  // matrix definite, which the implicit solve needs to stay stable.
+  for (int i = 0; i < springs.size(); i++) {
+    float restLen = springs[i][2];
+    float stiff = springs[i][3];
+    int ind1 = (int) springs[i][0];
+    int ind2 = (int) springs[i][1];
+    Vector3f d(x[ind1] - x[ind2], y[ind1] - y[ind2], z[ind1] - z[ind2]);
+    float len = d.abs();
+    if (len < 1e-6f) {
+      continue;
+    }
+    Vector3f u = d / len;
+    float s = 1 - restLen / len;
+    if (clampCompressed) {
+      s = max(0.0f, s);
+    }
+
+    float J[9];
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        J[3 * r + c] = -stiff / M * ((r == c ? s : 0) + (1 - s) * u[r] * u[c]);
+      }
+    }
+    dadx.addSpring(max(ind1, ind2), min(ind1, ind2), J);
+  }
+}
+
+bool HairSystem::isPinned(int i) const
+{
+  return find(fixedPtIndex.begin(), fixedPtIndex.end(), i) != fixedPtIndex.end();
+}
+
+void HairSystem::evalExternalAcceleration(const float* pos, const float* vel, float* acc)
+{
+  // gravity, drag, wind and anything external, as in HairStrand<N>
+  StrandForces p = strandForces();
+  for (int i = 0; i < H; i++) {
+    float w = windWeight(i, H);
+    for (int c = 0; c < 3; c++) {
+      acc[c * H + i] = vel[c * H + i] * -p.drag / p.mass + p.wind[c] * w;
+      if (p.external) {
+        acc[c * H + i] += p.external[c * H + i];
+      }
+    }
+    acc[H + i] -= p.gravity;
+  }
+}
+
+void HairSystem::projectCollisions(float* pos) const
+{
+  projectOutOfCollider(pos);
+}
+
+void HairSystem::projectCollision(float* pos, int i) const
+{
+  projectOutOfCollider(pos, i);
+}
+
+void HairSystem::draw(GLProgram& gl, VertexRecorder curveRec, VertexRecorder surfaceRec, StateView s)
 {
   gl.disableLighting();
   gl.updateModelMatrix(Matrix4f::identity());
 
-  vector<Vector3f> state = getState();
   vector<Vector3f> points;
-  points.push_back(state[0]);
+  points.reserve(H + 1);
+  points.push_back(s.position(0));
   for (int i = 0; i < H; i++) {
-    points.push_back(state[2 * i]);
+    points.push_back(s.position(i));
   }
 
   Curve curve = evalBspline(points, 8);
@@ -132,14 +388,332 @@ void HairSystem::draw(GLProgram& gl, VertexRecorder curveRec, VertexRecorder sur
   surfaceRec.draw(GL_TRIANGLES);
 }
 
+void HairSystem::wake() {
+  // an awake strand keeps its window, whatever woke it shows up in there
+  if (asleep) {
+    asleep = false;
+    windowTime = 0;
+  }
+}
+
+void HairSystem::updateSleep(float h) {
+  float* s = state();
+  int half = positionSize();
+  // positions at the start and in the middle of the window
+  float* start = &windowStart[0];
+  float* middle = start + half;
+
+  if (windowTime == 0) {
+    copy(s, s + half, start);
+  }
+  if (windowTime < SLEEP_TIME / 2 && windowTime + h >= SLEEP_TIME / 2) {
+    copy(s, s + half, middle);
+  }
+  windowTime += h;
+  if (windowTime < SLEEP_TIME) {
+    return;
+  }
+
+  // Kinetic energy and force residual are judged by averages over the
+  // window taken from positions alone: the mean speed, and the mean
+  // acceleration from the two half-window mean speeds. Particles resting
+  // on the head rattle in and out of its penalty shell, so their
+  // velocities and forces never settle from one step to the next, but
+  // the rattle barely moves them.
+  float t = windowTime / 2;
+  float drift = 0;
+  float bend = 0;
+  for (int i = 0; i < half; i++) {
+    drift = max(drift, (float) fabs(s[i] - start[i]));
+    bend = max(bend, (float) fabs(s[i] - 2 * middle[i] + start[i]));
+  }
+  lastSpeed = drift / windowTime;
+  float accel = bend / (t * t);
+  windowTime = 0;
+
+  if (lastSpeed < SLEEP_SPEED && accel < SLEEP_ACCEL) {
+    // come to a full stop, so waking up starts from rest
+    for (int i = half; i < stateSize(); i++) {
+      s[i] = 0;
+    }
+    asleep = true;
+    invalidateAcceleration();
+  }
+}
+
+int HairSystem::limitStrain(float maxStretch) {
+  float* x = state();
+  float* v = x + 3 * H;
+  int clamped = 0;
+  // the core springs come first, from the root down
+  for (int k = 0; k < H - 1; k++) {
+    int i = (int) springs[k][0];
+    int j = (int) springs[k][1];
+    Vector3f d = position(j) - position(i);
+    float len = d.abs();
+    float limit = springs[k][2] * (1 + maxStretch);
+    if (len <= limit || isPinned(j)) {
+      continue;
+    }
+    Vector3f u = d / len;
+    Vector3f dv(v[j] - v[i], v[H + j] - v[H + i], v[2 * H + j] - v[2 * H + i]);
+    float separating = max(0.0f, Vector3f::dot(dv, u));
+    for (int c = 0; c < 3; c++) {
+      x[c * H + j] = x[c * H + i] + limit * u[c];
+      v[c * H + j] -= separating * u[c];
+    }
+    clamped++;
+  }
+  checkedSprings += H - 1;
+  clampedSprings += clamped;
+  if (clamped > 0) {
+    // the positions moved under a cached acceleration
+    invalidateAcceleration();
+  }
+  return clamped;
+}
+
+double HairSystem::staticEnergy(const double* pos, double* grad) const
+{
+  StrandForces p = strandForces();
+  double energy = 0;
+  if (grad) {
+    fill(grad, grad + 3 * H, 0.0);
+  }
+
+  // gravity and wind are constant forces f, with energy -f . x
+  for (int i = 0; i < H; i++) {
+    float w = i > H / 2 ? (i > H * 3 / 4 ? 2.0f : 1.0f) : 0.0f;
+    float f[3] = { p.wind[0] * w, p.wind[1] * w - p.gravity, p.wind[2] * w };
+    for (int c = 0; c < 3; c++) {
+      energy -= f[c] * pos[c * H + i];
+      if (grad) {
+        grad[c * H + i] -= f[c];
+      }
+    }
+  }
+
+  // springs: k/2 (l - L)^2
+  for (int i = 0; i < springs.size(); i++) {
+    double restLen = springs[i][2];
+    double stiff = springs[i][3] / M;
+    int ind1 = (int) springs[i][0];
+    int ind2 = (int) springs[i][1];
+    double d[3];
+    for (int c = 0; c < 3; c++) {
+      d[c] = pos[c * H + ind1] - pos[c * H + ind2];
+    }
+    double len = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    double stretch = len - restLen;
+    energy += 0.5 * stiff * stretch * stretch;
+    if (grad && len > 1e-9) {
+      for (int c = 0; c < 3; c++) {
+        double g = stiff * stretch / len * d[c];
+        grad[c * H + ind1] += g;
+        grad[c * H + ind2] -= g;
+      }
+    }
+  }
+  return energy;
+}
+
+template <class T>
+void HairSystem::projectOutOfCollider(T* pos) const
+{
+  for (int i = 0; i < H; i++) {
+    projectOutOfCollider(pos, i);
+  }
+}
+
+template <class T>
+void HairSystem::projectOutOfCollider(T* pos, int i) const
+{
+  if (!collider || isPinned(i)) {
+    return;
+  }
+  // a step along the normal only lands on the surface where it is
+  // flat, and the static solve needs it to land there
+  for (int step = 0; step < PROJECTION_STEPS; step++) {
+    Vector3f normal;
+    float d = collider->distance(Vector3f(pos[i], pos[H + i], pos[2 * H + i]), &normal, &contactHints[i]);
+    if (d >= SURFACE_GAP) {
+      break;
+    }
+    for (int c = 0; c < 3; c++) {
+      pos[c * H + i] += (SURFACE_GAP - d) * normal[c];
+    }
+  }
+}
+
+bool HairSystem::settle(int maxIterations)
+{
+  // Newton on the potential energy, with the collider as a constraint
+  // rather than the penalty shell the dynamics use: the shell's push is
+  // a step function with no useful derivative. Each iteration solves the
+  // same banded system as ImplicitEuler, A dx = f with A = -da/dx, then
+  // searches along dx for lower energy.
+  //
+  // Near the solution the energy changes by less than float rounding of
+  // the positions, so the iteration runs on doubles and only the result
+  // is rounded into the state.
+  int half = positionSize();
+  int bandwidth = jacobianBandwidth();
+  float* xf = scratch(2 * half + BandedBlockMatrix::storageSize(H, bandwidth));
+  float* dx = xf + half;
+  BandedBlockMatrix A(dx + half, H, bandwidth);
+  vector<double> x(state(), state() + half);
+  vector<double> trial(half);
+  vector<double> grad(half);
+
+  projectOutOfCollider(&x[0]);
+  double energy = staticEnergy(&x[0], &grad[0]);
+
+  // energy at x + t dx, pushed out of the collider, left in trial
+  auto trialEnergy = [&](float t) {
+    for (int i = 0; i < half; i++) {
+      trial[i] = x[i] + t * dx[i];
+    }
+    projectOutOfCollider(&trial[0]);
+    return staticEnergy(&trial[0], nullptr);
+  };
+
+  // The exact Hessian of the springs is indefinite where compressed
+  // springs buckle; when it doesn't lead downhill, fall back to the
+  // clamped one ImplicitEuler uses for that iteration.
+  bool exact = true;
+  vector<float> force(half);
+  bool settled = false;
+  for (int iteration = 0; ; iteration++) {
+    copy(x.begin(), x.end(), xf);
+    A.clear();
+    addSpringJacobian(xf, A, !exact);
+    A.scale(-1);
+
+    // Particles resting on the collider can't move inwards, so that part
+    // of their force doesn't count; they are held on the surface instead.
+    float residual = 0;
+    for (int i = 0; i < H; i++) {
+      Vector3f f(-grad[i], -grad[H + i], -grad[2 * H + i]);
+      Vector3f n;
+      float d = collider ? collider->distance(Vector3f(x[i], x[H + i], x[2 * H + i]), &n, &contactHints[i]) : FLT_MAX;
+      Vector3f hold = Vector3f::ZERO;
+      if (isPinned(i)) {
+        f = Vector3f::ZERO;
+      } else if (d < SURFACE_GAP + CONTACT_SLACK) {
+        float push = Vector3f::dot(f, n);
+        if (push < 0) {
+          f -= push * n;
+          hold = CONTACT_STIFFNESS * (SURFACE_GAP - d) * n;
+          float* block = A.block(i, i);
+          for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 3; col++) {
+              block[3 * row + col] += CONTACT_STIFFNESS * n[row] * n[col];
+            }
+          }
+        }
+      }
+      for (int c = 0; c < 3; c++) {
+        force[c * H + i] = dx[c * H + i] = f[c] + hold[c];
+      }
+      residual = max(residual, f.abs());
+    }
+    if (residual < SETTLE_TOLERANCE) {
+      settled = true;
+      break;
+    }
+    if (iteration == maxIterations) {
+      break;
+    }
+
+    for (int i = 0; i < H; i++) {
+      A.addDiagonal(i, SETTLE_REGULARIZATION);
+      if (isPinned(i)) {
+        A.pin(i);
+      }
+    }
+    float step = 0;
+    if (A.factor()) {
+      A.solve(dx, dx + H, dx + 2 * H);
+      double slope = 0;
+      for (int i = 0; i < half; i++) {
+        slope += dx[i] * force[i];
+      }
+
+      // The Hessian misjudges the curvature of soft modes like a strand
+      // swinging over the head, so keep doubling the step while that
+      // helps, else halve it until it does.
+      double best = energy;
+      for (float t = 1; slope > 0 && t < 1e3f; t *= 2) {
+        double e = trialEnergy(t);
+        if (!(e < best)) {
+          break;
+        }
+        best = e;
+        step = t;
+      }
+      for (float t = 0.5f; slope > 0 && step == 0 && t > 1e-4f; t *= 0.5f) {
+        if (trialEnergy(t) < best) {
+          step = t;
+        }
+      }
+    }
+
+    if (step == 0) {
+      if (!exact) {
+        break;
+      }
+      exact = false;
+      continue;
+    }
+    trialEnergy(step);
+    x.swap(trial);
+    energy = staticEnergy(&x[0], &grad[0]);
+    exact = true;
+  }
+
+  copy(x.begin(), x.end(), state());
+  startAtRest();
+  return settled;
+}
+
+void HairSystem::startAtRest()
+{
+  float* s = state();
+  fill(s + positionSize(), s + stateSize(), 0.0f);
+  asleep = false;
+  windowTime = 0;
+  invalidateAcceleration();
+}
+
+uint64_t HairSystem::settleKey(uint64_t h) const
+{
+  StrandForces p = strandForces();
+  h = hashBytes(state(), positionSize() * sizeof(float), h);
+  h = hashBytes(&springs[0], springs.size() * sizeof(Vector4f), h);
+  h = hashBytes(&fixedPtIndex[0], fixedPtIndex.size() * sizeof(int), h);
+  // the floats only: the collider is hashed by its owner rather than
+  // by address, and the padding before it is garbage
+  h = hashBytes(&p, offsetof(StrandForces, wind) + sizeof(p.wind), h);
+  float tolerance = SETTLE_TOLERANCE;
+  return hashBytes(&tolerance, sizeof(tolerance), h);
+}
+
 void HairSystem::setHairCurve(float l_input) {
+  // unchanged settings leave a settled strand asleep
+  if (springs[2*H - 3][2] == l_input * UNIT_H) {
+    return;
+  }
   for (int i = 2*H - 3; i < 3*H - 6; i++) {
     springs[i][2] = l_input * UNIT_H;
+    constraints[i].restLength = springs[i][2];
   }
+  invalidateAcceleration();
+  wake();
 }
 
 void HairSystem::toggleWind() {
   windBlowing = !windBlowing;
+  wake();
 }
 
 void HairSystem::toggleHighlight() {
@@ -153,7 +727,12 @@ void HairSystem::toggleHighlight() {
 }
 
 void HairSystem::setWindStrength(float strength) {
+  if (strength == windStrength) {
+    return;
+  }
   windStrength = strength;
+  invalidateAcceleration();
+  wake();
 }
 
 void HairSystem::setWindDirection(float index) {
@@ -161,13 +740,58 @@ void HairSystem::setWindDirection(float index) {
   float theta_max = M_PI;
   float offset = M_PI / 3;
   float theta = index * (theta_max - theta_min) + theta_min + offset;
+  Vector3f direction(cos(theta), 0, sin(theta));
+  if (direction == windDirection) {
+    return;
+  }
 
-  windDirection[0] = cos(theta);
-  windDirection[2] = sin(theta);
+  windDirection = direction;
+  invalidateAcceleration();
+  wake();
 }
 
 void HairSystem::setHairColor(float r, float g, float b) {
   hairColor[0] = r;
   hairColor[1] = g;
   hairColor[2] = b;
+}
+void HairSystem::setCollider(const Collider* shape) {
+  collider = shape;
+  fill(contactHints.begin(), contactHints.end(), -1);
+  invalidateAcceleration();
+  wake();
+}
+
+void HairSystem::setExternalAcceleration(const float* acc) {
+  // the acceleration is the external one plus what doesn't depend on it
+  int half = positionSize();
+  if (accelerationValid()) {
+    float* a = scratch(half);
+    for (int k = 0; k < half; k++) {
+      a[k] += (acc ? acc[k] : 0) - carriedExternal[k];
+    }
+    for (size_t f = 0; f < fixedPtIndex.size(); f++) {
+      a[fixedPtIndex[f]] = a[H + fixedPtIndex[f]] = a[2 * H + fixedPtIndex[f]] = 0;
+    }
+  }
+  for (int k = 0; k < half; k++) {
+    carriedExternal[k] = acc ? acc[k] : 0;
+  }
+  external = acc;
+}
+
+void HairSystem::velocitiesChanged(const float* before) {
+  if (!accelerationValid()) {
+    return;
+  }
+  // velocities only enter through the drag, linearly
+  int half = positionSize();
+  const float* v = state() + half;
+  float* a = scratch(half);
+  for (int k = 0; k < half; k++) {
+    a[k] += (v[k] - before[k]) * -K_DRAG / M;
+  }
+  for (size_t f = 0; f < fixedPtIndex.size(); f++) {
+    a[fixedPtIndex[f]] = a[H + fixedPtIndex[f]] = a[2 * H + fixedPtIndex[f]] = 0;
+  }
 }
\ No newline at end of file
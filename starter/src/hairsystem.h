@@ -4,11 +4,13 @@
 #include <vector>
 #include "particlesystem.h"
 #include "vertexrecorder.h"
+#include "hairstrand.h"
 
 const float GRAVITY = 9.8f;
 const float K_DRAG = 0.015f;
 const float M = 0.01f;
 const float COLLISION_RES = 1000.0f;
+const float HEAD_COLLISION_R = 1.07f;
 
 const float UNIT_H = 0.5f;
 const float HORI_DELTA = 0.3f;
@@ -21,28 +23,130 @@ const float CORE_K = 60.0f;
 const float SUPPORT_K = 30.0f;
 const float SUPPORT_L_3 = 3 * UNIT_H;
 
+// sleep: a strand whose particles moved slower than SLEEP_SPEED and
+// accelerated less than SLEEP_ACCEL on average over a window of
+// SLEEP_TIME seconds stops being integrated
+const float SLEEP_SPEED = 0.02f;
+const float SLEEP_ACCEL = 0.2f;
+const float SLEEP_TIME = 0.5f;
+// an awake strand faster than this wakes its neighbours
+const float WAKE_SPEED = 2 * SLEEP_SPEED;
+
+// static solve: Newton iterations stop once no free particle feels
+// more than SETTLE_TOLERANCE of net acceleration
+const float SETTLE_TOLERANCE = 0.05f;
+const int SETTLE_ITERATIONS = 100;
+
+// position-based steps: support constraints are this much more compliant
+// than their springs, since against inextensible cores the full stiffness
+// buckles the strand
+const float PBD_SUPPORT_SOFTNESS = 10.0f;
+
 class HairSystem : public ParticleSystem
 {
 public:
-  HairSystem() { /* puppet */ };
-  HairSystem(Vector3f origin, int length);
+  HairSystem() : collider(nullptr), external(nullptr), asleep(false), windowTime(0), lastSpeed(0), checkedSprings(0), clampedSprings(0) { /* puppet */ };
+  // state points at sliceSize(length) floats owned by the caller,
+  // which is where the strand keeps its positions and velocities
+  HairSystem(Vector3f origin, int length, float* state);
+
+  // evalAcceleration is called by the integrator at least once per time step
+  void evalAcceleration(const float* x, const float* v, float* a) override;
 
-  // evalF is called by the integrator at least once per time step
-  std::vector<Vector3f> evalF(std::vector<Vector3f> state) override;
+  // integrator and force kernel compiled together, for the lengths
+  // that have a HairStrand<N> kernel
+  bool takeStaticStep(StepMethod method, float stepSize) override;
 
-  // draw is called once per frame
-  void draw(GLProgram& ctx, VertexRecorder curveRec, VertexRecorder surfaceRec);
+  // spring Jacobians for implicit integration
+  int jacobianBandwidth() const override;
+  float evalJacobian(const float* in, BandedBlockMatrix& dadx) override;
+  bool isPinned(int i) const override;
+
+  // the springs as constraints for position-based integration, with the
+  // head as a collider
+  const std::vector<DistanceConstraint>* distanceConstraints() const override { return &constraints; }
+  void evalExternalAcceleration(const float* x, const float* v, float* a) override;
+  void projectCollisions(float* x) const override;
+  void projectCollision(float* x, int i) const override;
+
+  // draw is called once per frame, with this strand's state or a copy of it
+  void draw(GLProgram& ctx, VertexRecorder curveRec, VertexRecorder surfaceRec, StateView s);
 
   void setHairCurve(float l_input);
   void toggleWind();
   void toggleHighlight();
   void setWindStrength(float strength);
   void setWindDirection(float index);
+  // the wind the strand feels at full weight, and the weight of particle
+  // i of n: none on the upper half, doubled on the last quarter
+  Vector3f wind() const { return windStrength > 0 ? windDirection * windStrength : Vector3f::ZERO; }
+  static float windWeight(int i, int n) { return i > n / 2 ? (i > n * 3 / 4 ? 2.0f : 1.0f) : 0.0f; }
   void setHairColor(float r, float g, float b);
+  // what the strand collides with, null for nothing; the caller keeps
+  // it alive and unchanged while the strand uses it
+  void setCollider(const Collider* shape);
+  // Acceleration from outside the strand for every particle, x[H] y[H]
+  // z[H], or null for none. Held through the pointer, so the caller
+  // calls this again whenever it changes the values; it doesn't wake
+  // the strand. The acceleration velocity Verlet carries over is moved
+  // by the change instead of thrown away.
+  void setExternalAcceleration(const float* acc);
+  // Something outside the integrator changed the velocities from before,
+  // 3H floats; the carried acceleration follows the drag the same way.
+  void velocitiesChanged(const float* before);
+
+  // Sleeping strands are skipped by HairGroup::step. Anything that
+  // changes the forces on a strand wakes it; the setters above do.
+  bool isAsleep() const { return asleep; }
+  void wake();
+  // called after every step of h seconds; puts the strand to sleep at
+  // the end of a SLEEP_TIME window in which it has settled
+  void updateSleep(float h);
+  // fastest average particle speed over the last window
+  float speed() const { return lastSpeed; }
+
+  // Strain limiting, for any stepper: after a step, pull every core
+  // spring stretched by more than maxStretch (0.1 = 10%) back to that
+  // length and stop it stretching further. Goes from root to tip and
+  // only moves the outer particle. Returns how many springs it clamped.
+  int limitStrain(float maxStretch);
+  // core springs limitStrain has checked and clamped so far
+  long strainChecks() const { return checkedSprings; }
+  long strainClamps() const { return clampedSprings; }
+
+  // Move the strand straight to where springs, gravity and wind balance
+  // with the head pushing back, and stop it there. Returns false if it
+  // didn't get within SETTLE_TOLERANCE in maxIterations.
+  bool settle(int maxIterations = SETTLE_ITERATIONS);
+  // stop every particle where it is and start a fresh sleep window, as
+  // settle() leaves the strand
+  void startAtRest();
+  // hash of everything settle() depends on, chained onto h: the current
+  // positions, the springs and the forces
+  uint64_t settleKey(uint64_t h) const;
 
   // inherits
-//   std::vector<Vector3f> m_vVecState;
+//   float* m_state;
 private:
+  // batches strands of the same length into SIMD lanes
+  friend class StrandBatch;
+
+  // the spring list version of evalAcceleration, for any length
+  void evalAccelerationGeneric(const float* pos, const float* vel, float* acc);
+  // parameters for the fixed-length kernels in hairstrand.h
+  StrandForces strandForces() const;
+  // add the spring part of da/dx at positions in to dadx
+  void addSpringJacobian(const float* in, BandedBlockMatrix& dadx, bool clampCompressed) const;
+  // potential energy per unit mass of the springs, gravity and wind at
+  // positions pos, and its gradient if grad isn't null
+  double staticEnergy(const double* pos, double* grad) const;
+  // push particles inside the collider out onto its surface, all of
+  // them or just particle i
+  template <class T>
+  void projectOutOfCollider(T* pos) const;
+  template <class T>
+  void projectOutOfCollider(T* pos, int i) const;
+
   // hair length: number of layers
   int H;
   // private variables
@@ -52,8 +156,18 @@ private:
   //  3. Rest Length
   //  4. K
   std::vector<Vector4f> springs;
+  // the same springs as distance constraints, in the same order
+  std::vector<DistanceConstraint> constraints;
   // the indices of the points where they are fixed
   std::vector<int> fixedPtIndex;
+  const Collider* collider;
+  // the collider's hint for each particle, a cache lookups update even
+  // from const methods
+  mutable std::vector<int> contactHints;
+  // see setExternalAcceleration, and the values the carried acceleration
+  // includes, zero for none
+  const float* external;
+  std::vector<float> carriedExternal;
   // whether the wind should be blowing
   bool windBlowing;
   bool highlightCore;
@@ -62,6 +176,16 @@ private:
 
   Vector3f hairColor;
   Vector3f tempColor;
+
+  bool asleep;
+  // seconds into the current sleep window
+  float windowTime;
+  float lastSpeed;
+  // positions at the start and middle of the window, sized once
+  std::vector<float> windowStart;
+
+  long checkedSprings;
+  long clampedSprings;
 };
 
 
@@ -0,0 +1,268 @@
+#include "hairvolume.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+  // particles per chunk of parallel work
+  const int GRAIN = 4096;
+  // density, then momentum x y z
+  const int CHANNELS = 4;
+
+  inline bool finite3(float x, float y, float z) {
+    return fabs(x) < FLT_MAX && fabs(y) < FLT_MAX && fabs(z) < FLT_MAX;
+  }
+}
+
+HairVolume::HairVolume(float cellSize, float friction, float pressure, float restDensity)
+  : cellSize(cellSize), friction(friction), pressure(pressure), restDensity(restDensity), size(cellSize) {
+  origin[0] = origin[1] = origin[2] = 0;
+  dims[0] = dims[1] = dims[2] = 0;
+}
+
+void HairVolume::apply(float* state, int strandCount, int length, const char* movable, float h, ThreadPool& pool) {
+  int L = length;
+  int particles = strandCount * L;
+  if (particles == 0) {
+    return;
+  }
+  // component c of particle p, positions then velocities
+  auto at = [state, L](int p, int c) -> float& { return state[(p / L) * 6 * L + c * L + p % L]; };
+
+  // bounds of everything that isn't lost at infinity
+  int chunks = (particles + GRAIN - 1) / GRAIN;
+  chunkBounds.assign(6 * chunks, 0.0f);
+  pool.parallelFor(chunks, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      float* bounds = &chunkBounds[6 * c];
+      fill(bounds, bounds + 3, FLT_MAX);
+      fill(bounds + 3, bounds + 6, -FLT_MAX);
+      for (int p = c * GRAIN; p < min(particles, (c + 1) * GRAIN); p++) {
+        float x[3] = { at(p, 0), at(p, 1), at(p, 2) };
+        if (!finite3(x[0], x[1], x[2])) {
+          continue;
+        }
+        for (int a = 0; a < 3; a++) {
+          bounds[a] = min(bounds[a], x[a]);
+          bounds[3 + a] = max(bounds[3 + a], x[a]);
+        }
+      }
+    }
+  });
+  float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+  float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+  for (int c = 0; c < chunks; c++) {
+    for (int a = 0; a < 3; a++) {
+      lo[a] = min(lo[a], chunkBounds[6 * c + a]);
+      hi[a] = max(hi[a], chunkBounds[6 * c + 3 + a]);
+    }
+  }
+  if (lo[0] > hi[0]) {
+    return;
+  }
+
+  // cells of cellSize unless the hair is too big for MAX_CELLS of them
+  float extent = max(hi[0] - lo[0], max(hi[1] - lo[1], hi[2] - lo[2]));
+  size = max(cellSize, extent / (MAX_CELLS - 1));
+  if (!(size < FLT_MAX)) {
+    return;
+  }
+  float inverseSize = 1 / size;
+  for (int a = 0; a < 3; a++) {
+    origin[a] = lo[a];
+    dims[a] = min(MAX_CELLS, (int) ((hi[a] - lo[a]) * inverseSize) + 1);
+  }
+  int cells = dims[0] * dims[1] * dims[2];
+  int nodes = (dims[0] + 1) * (dims[1] + 1) * (dims[2] + 1);
+  int slab = dims[0] * dims[1];
+
+  // which cell every particle is in, and how many each cell holds
+  if (cellCounts.size() < (size_t) cells) {
+    vector<atomic<int> > counts(cells);
+    cellCounts.swap(counts);
+  }
+  cellStarts.resize(cells + 1);
+  particleCells.resize(particles);
+  sorted.resize(particles);
+  pool.parallelFor(dims[2], 1, [&](int begin, int end) {
+    for (int i = begin * slab; i < end * slab; i++) {
+      cellCounts[i].store(0, memory_order_relaxed);
+    }
+  });
+  pool.parallelFor(particles, GRAIN, [&](int begin, int end) {
+    for (int p = begin; p < end; p++) {
+      float x[3] = { at(p, 0), at(p, 1), at(p, 2) };
+      if (!finite3(x[0], x[1], x[2])) {
+        particleCells[p] = -1;
+        continue;
+      }
+      int cell[3];
+      for (int a = 0; a < 3; a++) {
+        cell[a] = min(dims[a] - 1, max(0, (int) ((x[a] - origin[a]) * inverseSize)));
+      }
+      int index = (cell[2] * dims[1] + cell[1]) * dims[0] + cell[0];
+      particleCells[p] = index;
+      cellCounts[index].fetch_add(1, memory_order_relaxed);
+    }
+  });
+
+  // starts of the cells, a slab of cells at a time; the counts become
+  // the cursors for the scatter
+  vector<int> slabStarts(dims[2] + 1, 0);
+  pool.parallelFor(dims[2], 1, [&](int begin, int end) {
+    for (int z = begin; z < end; z++) {
+      int count = 0;
+      for (int i = z * slab; i < (z + 1) * slab; i++) {
+        count += cellCounts[i].load(memory_order_relaxed);
+      }
+      slabStarts[z + 1] = count;
+    }
+  });
+  for (int z = 0; z < dims[2]; z++) {
+    slabStarts[z + 1] += slabStarts[z];
+  }
+  pool.parallelFor(dims[2], 1, [&](int begin, int end) {
+    for (int z = begin; z < end; z++) {
+      int start = slabStarts[z];
+      for (int i = z * slab; i < (z + 1) * slab; i++) {
+        cellStarts[i] = start;
+        start += cellCounts[i].load(memory_order_relaxed);
+        cellCounts[i].store(cellStarts[i], memory_order_relaxed);
+      }
+    }
+  });
+  cellStarts[cells] = slabStarts[dims[2]];
+
+  pool.parallelFor(particles, GRAIN, [&](int begin, int end) {
+    for (int p = begin; p < end; p++) {
+      if (particleCells[p] >= 0) {
+        sorted[cellCounts[particleCells[p]].fetch_add(1, memory_order_relaxed)] = p;
+      }
+    }
+  });
+  // in particle order within each cell, so the sums below don't depend
+  // on which thread got there first
+  pool.parallelFor(dims[2], 1, [&](int begin, int end) {
+    for (int i = begin * slab; i < end * slab; i++) {
+      sort(sorted.begin() + cellStarts[i], sorted.begin() + cellStarts[i + 1]);
+    }
+  });
+
+  // every node gathers density and momentum from the particles of the
+  // up to 8 cells around it, weighted trilinearly
+  grid.assign(CHANNELS * nodes, 0.0f);
+  smoothed.resize(CHANNELS * nodes);
+  pool.parallelFor(dims[2] + 1, 1, [&](int begin, int end) {
+    for (int z = begin; z < end; z++) {
+      for (int y = 0; y <= dims[1]; y++) {
+        for (int x = 0; x <= dims[0]; x++) {
+          float* g = &grid[CHANNELS * node(x, y, z)];
+          int n[3] = { x, y, z };
+          for (int cz = max(0, z - 1); cz <= min(z, dims[2] - 1); cz++) {
+            for (int cy = max(0, y - 1); cy <= min(y, dims[1] - 1); cy++) {
+              for (int cx = max(0, x - 1); cx <= min(x, dims[0] - 1); cx++) {
+                int index = (cz * dims[1] + cy) * dims[0] + cx;
+                for (int k = cellStarts[index]; k < cellStarts[index + 1]; k++) {
+                  int p = sorted[k];
+                  float w = 1;
+                  for (int a = 0; a < 3; a++) {
+                    float f = (at(p, a) - origin[a]) * inverseSize - n[a];
+                    w *= max(0.0f, 1 - fabs(f));
+                  }
+                  g[0] += w;
+                  for (int c = 0; c < 3; c++) {
+                    g[1 + c] += w * at(p, 3 + c);
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  });
+
+  for (int axis = 0; axis < 3; axis++) {
+    smooth(axis, pool);
+  }
+
+  // velocities blended towards the grid's and pushed down the gradient
+  // of the density above rest
+  float blend = 1 - exp(-friction * h);
+  pool.parallelFor(particles, GRAIN, [&](int begin, int end) {
+    for (int p = begin; p < end; p++) {
+      if (!movable[p] || particleCells[p] < 0) {
+        continue;
+      }
+      int cell[3];
+      float f[3];
+      for (int a = 0; a < 3; a++) {
+        float u = (at(p, a) - origin[a]) * inverseSize;
+        cell[a] = min(dims[a] - 1, max(0, (int) u));
+        f[a] = min(1.0f, max(0.0f, u - cell[a]));
+      }
+      float density = 0;
+      float momentum[3] = { 0, 0, 0 };
+      float gradient[3] = { 0, 0, 0 };
+      for (int corner = 0; corner < 8; corner++) {
+        int o[3] = { corner & 1, (corner >> 1) & 1, corner >> 2 };
+        float w[3], dw[3];
+        for (int a = 0; a < 3; a++) {
+          w[a] = o[a] ? f[a] : 1 - f[a];
+          dw[a] = (o[a] ? 1 : -1) * inverseSize;
+        }
+        const float* g = &grid[CHANNELS * node(cell[0] + o[0], cell[1] + o[1], cell[2] + o[2])];
+        float weight = w[0] * w[1] * w[2];
+        density += weight * g[0];
+        for (int c = 0; c < 3; c++) {
+          momentum[c] += weight * g[1 + c];
+        }
+        float excess = max(0.0f, g[0] - restDensity);
+        gradient[0] += dw[0] * w[1] * w[2] * excess;
+        gradient[1] += w[0] * dw[1] * w[2] * excess;
+        gradient[2] += w[0] * w[1] * dw[2] * excess;
+      }
+      for (int c = 0; c < 3; c++) {
+        float& v = at(p, 3 + c);
+        if (density > 0) {
+          v += blend * (momentum[c] / density - v);
+        }
+        v -= pressure * h * gradient[c];
+      }
+    }
+  });
+}
+
+void HairVolume::smooth(int axis, ThreadPool& pool) {
+  int n[3] = { dims[0] + 1, dims[1] + 1, dims[2] + 1 };
+  int stride = axis == 0 ? 1 : axis == 1 ? n[0] : n[0] * n[1];
+  int count = n[axis];
+  int lines = n[0] * n[1] * n[2] / count;
+  pool.parallelFor(lines, 64, [&](int begin, int end) {
+    for (int line = begin; line < end; line++) {
+      // the first node of the line
+      int first;
+      if (axis == 0) {
+        first = line * n[0];
+      } else if (axis == 1) {
+        first = (line / n[0]) * n[0] * n[1] + line % n[0];
+      } else {
+        first = line;
+      }
+      for (int i = 0; i < count; i++) {
+        // the ends count themselves for the neighbour they lack
+        int k = first + i * stride;
+        int before = i > 0 ? k - stride : k;
+        int after = i < count - 1 ? k + stride : k;
+        for (int c = 0; c < CHANNELS; c++) {
+          smoothed[CHANNELS * k + c] = 0.25f * (grid[CHANNELS * before + c] + grid[CHANNELS * after + c]) +
+                                       0.5f * grid[CHANNELS * k + c];
+        }
+      }
+    }
+  });
+  grid.swap(smoothed);
+}
@@ -0,0 +1,72 @@
+#ifndef HAIR_SIMULATION_HAIRVOLUME_H
+#define HAIR_SIMULATION_HAIRVOLUME_H
+
+#include <atomic>
+#include <vector>
+#include "threadpool.h"
+
+// Hair as a volume rather than as strands: particle velocities and
+// density splatted onto a coarse grid over the whole group, and every
+// particle nudged back towards what the grid holds.
+//
+// Each particle's velocity is blended towards the smoothed grid velocity
+// at its position, which lets nearby strands move together and damps
+// them against each other, and is pushed down the gradient of the
+// density above a rest density, which keeps the hair from collapsing
+// into less volume than it has. Neither looks at pairs of strands, so
+// the cost is a fixed amount per particle and per cell, however many
+// strands there are.
+//
+// Particles are sorted into cells and every grid node gathers from the
+// cells around it, so the splat needs no atomics on floats and gives the
+// same result whatever the number of threads.
+class HairVolume {
+public:
+  // Grid cells of cellSize, grown when the hair spans more than
+  // MAX_CELLS of them along an axis. friction is how fast, per second,
+  // velocities blend into the grid's; pressure is the acceleration per
+  // unit of density gradient above restDensity, with density counted in
+  // particles per cell.
+  HairVolume(float cellSize, float friction, float pressure, float restDensity);
+
+  // Correct the velocities in state for a step of h seconds. state is
+  // laid out like HairGroup::groupState(); every particle adds to the
+  // grid, but only those flagged in movable (one flag per particle,
+  // strand after strand) are corrected.
+  void apply(float* state, int strandCount, int length, const char* movable, float h, ThreadPool& pool);
+
+  static const int MAX_CELLS = 64;
+
+private:
+  HairVolume(const HairVolume&);
+  HairVolume& operator=(const HairVolume&);
+
+  int node(int x, int y, int z) const { return (z * (dims[1] + 1) + y) * (dims[0] + 1) + x; }
+  // blur density and momentum with 1 2 1 along one axis
+  void smooth(int axis, ThreadPool& pool);
+
+  float cellSize;
+  float friction;
+  float pressure;
+  float restDensity;
+
+  // the grid of this apply(): low corner, size of its cells and how
+  // many along each axis; nodes are one more
+  float origin[3];
+  float size;
+  int dims[3];
+
+  // particles sorted by cell, through counts and starts as in a
+  // counting sort, and the cell of each
+  std::vector<std::atomic<int> > cellCounts;
+  std::vector<int> cellStarts;
+  std::vector<int> sorted;
+  std::vector<int> particleCells;
+  // per node: density, then momentum x y z, and a copy to smooth into
+  std::vector<float> grid;
+  std::vector<float> smoothed;
+  // per chunk of the pool's work, for the bounds
+  std::vector<float> chunkBounds;
+};
+
+#endif //HAIR_SIMULATION_HAIRVOLUME_H
@@ -0,0 +1,171 @@
+#ifndef HAIR_SIMULATION_INTEGRATORS_H
+#define HAIR_SIMULATION_INTEGRATORS_H
+
+#include <cstddef>
+#include "particlesystem.h"
+
+// The explicit integrators, written once as templates over the system.
+//
+// A System provides, all non-virtual:
+//   size_t stateSize(), size_t positionSize(), float* state(),
+//   float* scratch(size_t n),
+//   void evalF(const float* in, float* out, size_t n),
+//   void evalAcceleration(const float* x, const float* v, float* a),
+//   bool accelerationValid(), void setAccelerationValid(bool)
+//
+// Instantiated with a concrete kernel (see HairSystem::takeStaticStep) the
+// force evaluation is inlined into the update loops and each pairing
+// compiles to one function. Instantiated with DynamicSystem they are the
+// generic versions behind the TimeStepper classes.
+
+// forwards to the virtual interface of any ParticleSystem
+class DynamicSystem
+{
+public:
+    explicit DynamicSystem(ParticleSystem* system) : system(system) {}
+
+    size_t stateSize() const { return system -> stateSize(); }
+    size_t positionSize() const { return system -> positionSize(); }
+    float* state() { return system -> state(); }
+    float* scratch(size_t n) { return system -> scratch(n); }
+    void evalF(const float* in, float* out, size_t n) { system -> evalF(in, out, n); }
+    void evalAcceleration(const float* x, const float* v, float* a) { system -> evalAcceleration(x, v, a); }
+    bool accelerationValid() const { return system -> accelerationValid(); }
+    void setAccelerationValid(bool valid) { system -> setAccelerationValid(valid); }
+
+private:
+    ParticleSystem* system;
+};
+
+template <class System>
+void forwardEulerStep(System& system, float stepSize)
+{
+    size_t n = system.stateSize();
+    float* state = system.state();
+    float* f = system.scratch(n);
+
+    system.evalF(state, f, n);
+    for (size_t i = 0; i < n; i++) {
+       state[i] += stepSize * f[i];
+    }
+}
+
+template <class System>
+void trapezoidalStep(System& system, float stepSize)
+{
+    size_t n = system.stateSize();
+    float* state = system.state();
+    float* f0 = system.scratch(3 * n);
+    float* f1 = f0 + n;
+    float* state1 = f1 + n;
+
+    system.evalF(state, f0, n);
+    for (size_t i = 0; i < n; i++) {
+       state1[i] = state[i] + stepSize * f0[i];
+    }
+    system.evalF(state1, f1, n);
+
+    float half = 0.5 * stepSize;
+    for (size_t i = 0; i < n; i++) {
+       state[i] += half * (f0[i] + f1[i]);
+    }
+}
+
+template <class System>
+void rk4Step(System& system, float stepSize)
+{
+    size_t n = system.stateSize();
+    float* state = system.state();
+    float* k1 = system.scratch(5 * n);
+    float* k2 = k1 + n;
+    float* k3 = k2 + n;
+    float* k4 = k3 + n;
+    float* s = k4 + n;
+
+    float half = 0.5 * stepSize;
+    system.evalF(state, k1, n);
+    for (size_t i = 0; i < n; i++) {
+       s[i] = state[i] + half * k1[i];
+    }
+    system.evalF(s, k2, n);
+
+    for (size_t i = 0; i < n; i++) {
+       s[i] = state[i] + half * k2[i];
+    }
+    system.evalF(s, k3, n);
+
+    for (size_t i = 0; i < n; i++) {
+       s[i] = state[i] + stepSize * k3[i];
+    }
+    system.evalF(s, k4, n);
+
+    float sixth = (1.0 / 6.0) * stepSize;
+    for (size_t i = 0; i < n; i++) {
+       state[i] += sixth * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]);
+    }
+}
+
+template <class System>
+void symplecticEulerStep(System& system, float stepSize)
+{
+    size_t half = system.positionSize();
+    float* x = system.state();
+    float* v = x + half;
+    float* a = system.scratch(half);
+
+    system.evalAcceleration(x, v, a);
+    for (size_t i = 0; i < half; i++) {
+        v[i] += stepSize * a[i];
+        x[i] += stepSize * v[i];
+    }
+}
+
+template <class System>
+void velocityVerletStep(System& system, float stepSize)
+{
+    size_t half = system.positionSize();
+    float* x = system.state();
+    float* v = x + half;
+    // a holds the acceleration at the start of the step
+    float* a = system.scratch(half);
+    float h = stepSize;
+
+    if (!system.accelerationValid()) {
+        system.evalAcceleration(x, v, a);
+    }
+
+    for (size_t i = 0; i < half; i++) {
+        x[i] += h * v[i] + 0.5f * h * h * a[i];
+        v[i] += 0.5f * h * a[i];
+    }
+    system.evalAcceleration(x, v, a);
+    for (size_t i = 0; i < half; i++) {
+        v[i] += 0.5f * h * a[i];
+    }
+    system.setAccelerationValid(true);
+}
+
+// runs the step of the given method on a System
+template <class System>
+void staticStep(System& system, StepMethod method, float stepSize)
+{
+    switch (method) {
+        case STEP_FORWARD_EULER:
+            forwardEulerStep(system, stepSize);
+            break;
+        case STEP_TRAPEZOIDAL:
+            trapezoidalStep(system, stepSize);
+            break;
+        case STEP_RK4:
+            rk4Step(system, stepSize);
+            break;
+        case STEP_SYMPLECTIC_EULER:
+            symplecticEulerStep(system, stepSize);
+            break;
+        case STEP_VELOCITY_VERLET:
+            velocityVerletStep(system, stepSize);
+            break;
+    }
+}
+
+#endif //HAIR_SIMULATION_INTEGRATORS_H
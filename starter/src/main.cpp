@@ -14,6 +14,7 @@
 #include "timestepper.h"
 #include "hairsystem.h"
 #include "hairgroup.h"
+#include "simthread.h"
 
 using namespace std;
 namespace ng = ::nanogui;
@@ -22,7 +23,7 @@ namespace {
 // Declarations of functions whose implementations occur later.
   void initSystem();
 
-  void stepSystem();
+  void reportStats(const SimFrame& frame);
 
   void drawSystem();
 
@@ -38,19 +39,55 @@ namespace {
 const Vector3f LIGHT_POS(3.0f, 3.0f, 5.0f);
 const Vector3f LIGHT_COLOR(120.0f, 120.0f, 120.0f);
 const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
-
-// time keeping
-// current "tick" (e.g. clock number of processor)
-  uint64_t start_tick;
-// number of seconds since start of program
-  double elapsed_s;
-// number of seconds simulated
-  double simulated_s;
+// rest pose of the last groom, see HairGroup::settle
+const char* SETTLE_CACHE = "hair_settled.cache";
+
+// time keeping: the simulation thread keeps its own clock
+// simulated time of the last integrator statistics printout
+  double reported_s;
+// number of awake strands at the last printout
+  int reported_awake;
+// dropped real time at the last printout
+  double reported_dropped;
+// strain limit counters at the last printout
+  long reported_checks;
+  long reported_clamps;
+// neighbour list counters at the last printout
+  long reported_updates;
+  long reported_rebuilds;
+// most simulated seconds per frame, see FrameScheduler
+  double frameBudget = 0.1;
+// core spring stretch the strain limit allows, 0 = off
+  float strainLimit = 0;
+// whether strands push each other apart, see HairGroup::setHairCollision
+  bool hairCollision = false;
+// how far past the cohesion range neighbour lists reach, see
+// HairGroup::setNeighbourSkin
+  float neighbourSkin = 0.1f;
+// whether velocities are corrected through the volume grid, see
+// HairGroup::setHairVolume
+  bool hairVolume = false;
+// whether the wind gusts and swirls, see HairGroup::setTurbulentWind
+  bool turbulentWind = false;
+// radius the turbulent wind fades to half at, 0 = none, see
+// HairGroup::setWindFalloff
+  float windFalloff = 0;
+// what the sliders are set to, kept here so the hair settles under them
+// and a reset keeps them; see HairGroup::setHairCurve, setWindStrength
+// and setWindDirection
+  float hairCurve = 2.5f;
+  float windStrength = 0;
+  float windDirection = 0;
 
 // Globals here.
   TimeStepper *timeStepper;
   float h;
   char integrator;
+  int threadCount;
+// distance field file to collide with instead of the head sphere, if any
+  std::string colliderPath;
+// wind volume file to blow through the hair, if any
+  std::string windVolumePath;
   GLFWwindow *window;
   ng::Screen *screen;
 
@@ -62,6 +99,8 @@ const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
   VertexRecorder surfaceRec;
 
   HairGroup *hairGroup;
+  // steps hairGroup; physics changes from the GUI go through it
+  SimThread *simThread;
 
 // Function implementations
   static void keyCallback(GLFWwindow *window, int key,
@@ -182,15 +221,58 @@ const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
       case 'r':
         timeStepper = new RK4();
         break;
+      case 'i':
+        timeStepper = new ImplicitEuler();
+        break;
+      case 's':
+        timeStepper = new SymplecticEuler();
+        break;
+      case 'v':
+        timeStepper = new VelocityVerlet();
+        break;
+      case 'a':
+        // h is only an upper bound on the adaptive substeps
+        timeStepper = new DormandPrince(h);
+        break;
+      case 'p':
+        timeStepper = new PositionBased(PositionBased::GAUSS_SEIDEL);
+        break;
+      case 'f':
+        timeStepper = new PositionBased(PositionBased::FOLLOW_THE_LEADER);
+        break;
       default:
         printf("Unrecognized integrator\n");
         exit(-1);
     }
 
-    hairGroup = new HairGroup();
+    hairGroup = new HairGroup(threadCount);
+    if (!colliderPath.empty() && !hairGroup->loadCollider(colliderPath)) {
+      printf("Cannot read collider %s, colliding with the head instead\n", colliderPath.c_str());
+    }
+    if (!windVolumePath.empty() && !hairGroup->loadWindVolume(windVolumePath)) {
+      printf("Cannot read wind volume %s\n", windVolumePath.c_str());
+    }
+    hairGroup->setHairCurve(hairCurve);
+    hairGroup->setWindStrength(windStrength);
+    hairGroup->setWindDirection(windDirection);
+    hairGroup->setStrainLimit(strainLimit);
+    hairGroup->setHairCollision(hairCollision);
+    hairGroup->setNeighbourSkin(neighbourSkin);
+    hairGroup->setHairVolume(hairVolume);
+    hairGroup->setTurbulentWind(turbulentWind);
+    hairGroup->setWindFalloff(windFalloff);
+    // start from the rest pose instead of letting the hair fall into it
+    int settled = hairGroup->settle(SETTLE_CACHE);
+    if (settled < (int) hairGroup->hairs.size()) {
+      printf("%d of %d strands didn't settle\n", (int) hairGroup->hairs.size() - settled, (int) hairGroup->hairs.size());
+    }
+    simThread = new SimThread(hairGroup, timeStepper, h, frameBudget);
   }
 
   void freeSystem() {
+    // stop the simulation before freeing what it runs on
+    delete simThread;
+    simThread = nullptr;
     delete timeStepper;
     timeStepper = nullptr;
     delete hairGroup;
@@ -198,16 +280,52 @@ const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
   }
 
   void resetTime() {
-    elapsed_s = 0;
-    simulated_s = 0;
-    start_tick = glfwGetTimerValue();
+    reported_s = 0;
+    reported_awake = -1;
+    reported_dropped = 0;
+    reported_checks = 0;
+    reported_clamps = 0;
+    reported_updates = 0;
+    reported_rebuilds = 0;
   }
 
-  void stepSystem() {
-    // step until simulated_s has caught up with elapsed_s.
-    while (simulated_s < elapsed_s) {
-      hairGroup->step(timeStepper, h);
-      simulated_s += h;
+  // integrator, strain limit and neighbour list statistics once per
+  // simulated second, the number of awake strands whenever it changes,
+  // and time the simulation had to drop to keep up
+  void reportStats(const SimFrame& frame) {
+    if (frame.time - reported_s >= 1.0) {
+      DormandPrince *rk45 = dynamic_cast<DormandPrince *>(timeStepper);
+      if (rk45) {
+        printf("RK45 substeps: %ld accepted, %ld rejected\n",
+               rk45->acceptedSteps(), rk45->rejectedSteps());
+      }
+      long checks = frame.strainChecks - reported_checks;
+      long clamps = frame.strainClamps - reported_clamps;
+      if (checks > 0) {
+        printf("strain limit: clamped %ld of %ld core springs (%.2f%%)\n",
+               clamps, checks, 100.0 * clamps / checks);
+      }
+      reported_checks = frame.strainChecks;
+      reported_clamps = frame.strainClamps;
+      long updates = frame.neighbourUpdates - reported_updates;
+      long rebuilds = frame.neighbourRebuilds - reported_rebuilds;
+      if (updates > 0) {
+        printf("neighbour lists: rebuilt %ld of %ld steps (%.2f%%)\n",
+               rebuilds, updates, 100.0 * rebuilds / updates);
+      }
+      reported_updates = frame.neighbourUpdates;
+      reported_rebuilds = frame.neighbourRebuilds;
+      reported_s = frame.time;
+    }
+
+    if (frame.awake != reported_awake) {
+      printf("awake strands: %d of %d\n", frame.awake, (int) hairGroup->hairs.size());
+      reported_awake = frame.awake;
+    }
+
+    if (frame.dropped - reported_dropped >= 0.1) {
+      printf("simulation can't keep up within the frame budget, %.1f s dropped so far\n", frame.dropped);
+      reported_dropped = frame.dropped;
     }
   }
 
@@ -217,7 +335,11 @@ const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
     // particle systems need for drawing themselves
     GLProgram gl(program_light, program_color, &camera);
     gl.updateLight(LIGHT_POS, LIGHT_COLOR.xyz()); // once per frame
-    hairGroup->draw(gl, curveRec, surfaceRec);
+    // the latest state the simulation thread published, blended
+    // between its last two steps
+    const SimFrame& frame = simThread->blended();
+    hairGroup->draw(gl, curveRec, surfaceRec, &frame.state[0], &frame.renderPoints[0]);
+    reportStats(frame);
   }
 
   void initRendering() {
@@ -283,14 +405,13 @@ const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
     ng::Slider *curvatureSlider = new ng::Slider(curvaturePanel);
     curvatureSlider->setFixedWidth(160);
     curvatureSlider->setFixedHeight(ROWH);
-    curvatureSlider->setValue(0.5);
-    curvatureSlider->setCallback([](float value) {
-      float l_min_index = 1;
-      float l_max_index = 4;
-      float l_input = l_max_index - value * (l_max_index - l_min_index);
-      hairGroup->setHairCurve(l_input);
+    float l_min_index = 1;
+    float l_max_index = 4;
+    curvatureSlider->setValue((l_max_index - hairCurve) / (l_max_index - l_min_index));
+    curvatureSlider->setCallback([l_min_index, l_max_index](float value) {
+      hairCurve = l_max_index - value * (l_max_index - l_min_index);
+      simThread->post(SimCommand(SimCommand::SET_HAIR_CURVE, hairCurve));
     });
-    curvatureSlider->notifyCallback();
 
 
     // 2. Wind Editor
@@ -315,14 +436,12 @@ const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
     ng::Slider *windeStrengthSlider = new ng::Slider(windPanel);
     windeStrengthSlider->setFixedWidth(160);
     windeStrengthSlider->setFixedHeight(ROWH);
-    windeStrengthSlider->setValue(0);
-    windeStrengthSlider->setCallback([](float value) {
-      float l_min_index = 0;
-      float l_max_index = 50;
-      float l_input = l_min_index + value * (l_max_index - l_min_index);
-      hairGroup->setWindStrength(l_input);
+    float w_max = 50;
+    windeStrengthSlider->setValue(windStrength / w_max);
+    windeStrengthSlider->setCallback([w_max](float value) {
+      windStrength = value * w_max;
+      simThread->post(SimCommand(SimCommand::SET_WIND_STRENGTH, windStrength));
     });
-    windeStrengthSlider->notifyCallback();
 
     // set wind direction
     ng::Label *windDirectionLabel = new ng::Label(windPanel, "Direction");
@@ -331,11 +450,34 @@ const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
     ng::Slider *windDirectionSlider = new ng::Slider(windPanel);
     windDirectionSlider->setFixedWidth(160);
     windDirectionSlider->setFixedHeight(ROWH);
-    windDirectionSlider->setValue(0);
+    windDirectionSlider->setValue(windDirection);
     windDirectionSlider->setCallback([](float value) {
-      hairGroup->setWindDirection(value);
+      windDirection = value;
+      simThread->post(SimCommand(SimCommand::SET_WIND_DIRECTION, windDirection));
+    });
+
+    // gusts and eddies around the wind set above
+    ng::Button *turbulenceButton = new ng::Button(windPanel, turbulentWind ? "Steady Wind" : "Turbulent Wind");
+    turbulenceButton->setCallback([turbulenceButton]() {
+      turbulentWind = !turbulentWind;
+      simThread->post(SimCommand(SimCommand::SET_TURBULENT_WIND, turbulentWind));
+      turbulenceButton->setCaption( turbulentWind ? "Steady Wind" : "Turbulent Wind");
+    });
+
+    // how far from its fan the turbulent wind reaches; all the way left
+    // turns the falloff off
+    ng::Label *falloffLabel = new ng::Label(windPanel, "Falloff");
+    falloffLabel->setFontSize(FONTSZ);
+
+    ng::Slider *falloffSlider = new ng::Slider(windPanel);
+    falloffSlider->setFixedWidth(160);
+    falloffSlider->setFixedHeight(ROWH);
+    float f_max = 10;
+    falloffSlider->setValue(windFalloff / f_max);
+    falloffSlider->setCallback([f_max](float value) {
+      windFalloff = value * f_max;
+      simThread->post(SimCommand(SimCommand::SET_WIND_FALLOFF, windFalloff));
     });
-    windDirectionSlider->notifyCallback();
 
 
     // 3. Color Picker
@@ -352,6 +494,7 @@ const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
     ng::Label *colorLabel = new ng::Label(colorPanel, "Hair Color");
     colorLabel->setFontSize(FONTSZ);
     ng::ColorWheel *hairColorSelector = new ng::ColorWheel(colorPanel);
+    // colors only matter for drawing, so they don't go through simThread
     hairColorSelector->setCallback([](ng::Color color) {
       hairGroup->setHairColor(color.x(), color.y(), color.z());
     });
@@ -366,6 +509,69 @@ const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
     });
 
 
+    // 4. Simulation
+    ng::Widget *simulationPanel = new ng::Widget(animator);
+    simulationPanel->setLayout(new ng::BoxLayout(ng::Orientation::Vertical, ng::Alignment::Minimum, 15, 0));
+
+    // most simulated time per frame; beyond it the simulation drops
+    // time instead of trying to catch up
+    ng::Label *budgetLabel = new ng::Label(simulationPanel, "Frame Budget");
+    budgetLabel->setFontSize(FONTSZ);
+
+    ng::Slider *budgetSlider = new ng::Slider(simulationPanel);
+    budgetSlider->setFixedWidth(160);
+    budgetSlider->setFixedHeight(ROWH);
+    budgetSlider->setValue(0.375);
+    budgetSlider->setCallback([](float value) {
+      float b_min = 0.01;
+      float b_max = 0.25;
+      frameBudget = b_min + value * (b_max - b_min);
+      simThread->post(SimCommand(SimCommand::SET_FRAME_BUDGET, frameBudget));
+    });
+
+    // how far core springs may stretch before they are clamped after a
+    // step; all the way left turns strain limiting off
+    ng::Label *strainLabel = new ng::Label(simulationPanel, "Strain Limit");
+    strainLabel->setFontSize(FONTSZ);
+
+    ng::Slider *strainSlider = new ng::Slider(simulationPanel);
+    strainSlider->setFixedWidth(160);
+    strainSlider->setFixedHeight(ROWH);
+    strainSlider->setValue(0);
+    strainSlider->setCallback([](float value) {
+      float s_max = 0.5;
+      strainLimit = value * s_max;
+      simThread->post(SimCommand(SimCommand::SET_STRAIN_LIMIT, strainLimit));
+    });
+
+    ng::Button *hairCollisionButton = new ng::Button(simulationPanel, hairCollision ? "Stop Hair Collision" : "Start Hair Collision");
+    hairCollisionButton->setCallback([hairCollisionButton]() {
+      hairCollision = !hairCollision;
+      simThread->post(SimCommand(SimCommand::SET_HAIR_COLLISION, hairCollision));
+      hairCollisionButton->setCaption( hairCollision ? "Stop Hair Collision" : "Start Hair Collision");
+    });
+
+    ng::Label *skinLabel = new ng::Label(simulationPanel, "Neighbour Skin");
+    skinLabel->setFontSize(FONTSZ);
+
+    ng::Slider *skinSlider = new ng::Slider(simulationPanel);
+    skinSlider->setFixedWidth(160);
+    skinSlider->setFixedHeight(ROWH);
+    float k_max = 0.5;
+    skinSlider->setValue(neighbourSkin / k_max);
+    skinSlider->setCallback([k_max](float value) {
+      neighbourSkin = value * k_max;
+      simThread->post(SimCommand(SimCommand::SET_NEIGHBOUR_SKIN, neighbourSkin));
+    });
+
+    ng::Button *hairVolumeButton = new ng::Button(simulationPanel, hairVolume ? "Stop Hair Volume" : "Start Hair Volume");
+    hairVolumeButton->setCallback([hairVolumeButton]() {
+      hairVolume = !hairVolume;
+      simThread->post(SimCommand(SimCommand::SET_HAIR_VOLUME, hairVolume));
+      hairVolumeButton->setCaption( hairVolume ? "Stop Hair Volume" : "Start Hair Volume");
+    });
+
+
     //============================
     //  GUI Specification Ends
     //============================
@@ -443,21 +649,37 @@ const Vector3f FLOOR_COLOR(1.0f, 0.0f, 0.0f);
 // Set up OpenGL, define the callbacks and start the main loop
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
-        printf("Usage: %s <e|t|r> <timestep>\n", argv[0]);
+    if (argc < 3 || argc > 6) {
+        printf("Usage: %s <e|t|r|s|v|i|a|p|f> <timestep> [threads] [collider] [wind volume]\n", argv[0]);
         printf("       e: Integrator: Forward Euler\n");
         printf("       t: Integrator: Trapezoid\n");
         printf("       r: Integrator: RK 4\n");
+        printf("       s: Integrator: Symplectic Euler\n");
+        printf("       v: Integrator: Velocity Verlet\n");
+        printf("       i: Integrator: Implicit Euler\n");
+        printf("       a: Integrator: adaptive RK 4(5), timestep is the largest substep\n");
+        printf("       p: Integrator: position based (Gauss-Seidel)\n");
+        printf("       f: Integrator: follow the leader\n");
+        printf("       threads: simulation threads, 0 = one per core (default), 1 = serial\n");
+        printf("       collider: distance field file (see distancefield.h) or .obj mesh, default the head\n");
+        printf("       wind volume: air velocities over time to blow through the hair (see windvolume.h)\n");
         printf("\n");
         printf("Try  : %s t 0.001\n", argv[0]);
         printf("       for trapezoid (1ms steps)\n");
         printf("Or   : %s r 0.01\n", argv[0]);
         printf("       for RK4 (10ms steps)\n");
+        printf("Or   : %s i 0.0166\n", argv[0]);
+        printf("       for implicit Euler (one step per frame)\n");
+        printf("Or   : %s f 0.0333\n", argv[0]);
+        printf("       for follow the leader (cheap, inextensible strands)\n");
         return -1;
     }
 
     integrator = argv[1][0];
     h = (float)atof(argv[2]);
+    threadCount = argc >= 4 ? atoi(argv[3]) : 0;
+    colliderPath = argc >= 5 ? argv[4] : "";
+    windVolumePath = argc == 6 ? argv[5] : "";
     printf("Using Integrator %c with time step %.4f\n", integrator, h);
 
     // Setup particle system
@@ -490,39 +712,28 @@ int main(int argc, char** argv)
     camera.SetDistance(10);
 
     // Main Loop
-    uint64_t freq = glfwGetTimerFrequency();
+    // the simulation runs on its own thread, this one only draws
     resetTime();
-    int counter = 0;
     while (!glfwWindowShouldClose(window)) {
-      // update every step
-      uint64_t now = glfwGetTimerValue();
-      elapsed_s = (double)(now - start_tick) / freq;
-      stepSystem();
-
-      // Draw every n steps for performance purpose
-      if (counter == 0) {
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // draw nanogui
-        screen->drawContents();
-        screen->drawWidgets();
-        glEnable(GL_DEPTH_TEST);
+      // draw nanogui
+      screen->drawContents();
+      screen->drawWidgets();
+      glEnable(GL_DEPTH_TEST);
 
-        setViewport(window);
-        drawSystem();
+      setViewport(window);
+      drawSystem();
 
-        // Make back buffer visible
-        glfwSwapBuffers(window);
+      // Make back buffer visible
+      glfwSwapBuffers(window);
 
-        // Check if any input happened during the last frame
-        glfwPollEvents();
-      }
+      // Check if any input happened during the last frame
+      glfwPollEvents();
 
       if (gMousePressed) {
           drawAxis();
       }
-
-      counter = (counter + 1) % 3;
     }
 
     freeGUI();
@@ -0,0 +1,59 @@
+#include "mappedfile.h"
+
+#include <fstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+bool MappedFile::open(const string& path) {
+  close();
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+  void* p = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive on its own
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  bytes = (const char*) p;
+  length = info.st_size;
+#else
+  ifstream in(path.c_str(), ios::binary | ios::ate);
+  if (!in || in.tellg() <= 0) {
+    return false;
+  }
+  contents.resize((size_t) in.tellg());
+  in.seekg(0);
+  if (!in.read(&contents[0], contents.size())) {
+    contents.clear();
+    return false;
+  }
+  bytes = &contents[0];
+  length = contents.size();
+#endif
+  return true;
+}
+
+void MappedFile::close() {
+#ifndef _WIN32
+  if (bytes) {
+    munmap((void*) bytes, length);
+  }
+#endif
+  contents.clear();
+  bytes = nullptr;
+  length = 0;
+}
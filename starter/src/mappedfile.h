@@ -0,0 +1,34 @@
+#ifndef HAIR_SIMULATION_MAPPEDFILE_H
+#define HAIR_SIMULATION_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A whole file, read-only, mapped into memory. Pages are read in by the
+// OS as they are touched instead of copied through a read buffer up
+// front. Where mmap isn't available the file is read into memory.
+class MappedFile {
+public:
+  MappedFile() : bytes(nullptr), length(0) {}
+  ~MappedFile() { close(); }
+
+  // returns false if the file can't be opened or is empty
+  bool open(const std::string& path);
+  void close();
+
+  bool isOpen() const { return bytes != nullptr; }
+  const char* data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  const char* bytes;
+  size_t length;
+  // the file read into memory where it can't be mapped
+  std::vector<char> contents;
+};
+
+#endif //HAIR_SIMULATION_MAPPEDFILE_H
@@ -0,0 +1,430 @@
+#include "meshcollider.h"
+#include "settlecache.h"
+#include "surf.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <utility>
+
+using namespace std;
+
+namespace {
+  // most triangles in a leaf
+  const int LEAF_SIZE = 4;
+  // deeper than a median split gets for any mesh that fits in memory
+  const int MAX_DEPTH = 64;
+  // most cells along each side of the grid of sides
+  const int MAX_SIDE_CELLS = 64;
+  // closer than this to the surface the direction to the closest point
+  // is rounding noise, and the pseudonormal is the normal
+  const float NORMAL_EPSILON = 1e-6f;
+
+  // Vector3f's operators aren't inlined, and the lookup is all of them
+  struct Point {
+    float x, y, z;
+  };
+  inline Point point(const float* v) { Point p = { v[0], v[1], v[2] }; return p; }
+  inline Point operator+(const Point& a, const Point& b) { Point p = { a.x + b.x, a.y + b.y, a.z + b.z }; return p; }
+  inline Point operator-(const Point& a, const Point& b) { Point p = { a.x - b.x, a.y - b.y, a.z - b.z }; return p; }
+  inline Point operator*(float s, const Point& a) { Point p = { s * a.x, s * a.y, s * a.z }; return p; }
+  inline float dot(const Point& a, const Point& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+  inline Point cross(const Point& a, const Point& b) {
+    Point p = { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    return p;
+  }
+  inline Point unit(const Point& a) {
+    float len = sqrt(dot(a, a));
+    return len > 0 ? (1 / len) * a : a;
+  }
+  inline void store(const Point& p, float* v) { v[0] = p.x; v[1] = p.y; v[2] = p.z; }
+
+  // where on a triangle the closest point lies
+  enum Feature { FACE, EDGE_AB, EDGE_BC, EDGE_CA, CORNER_A, CORNER_B, CORNER_C };
+
+  // Closest point q to p on the triangle abc, by the Voronoi regions of
+  // its features (Ericson, Real-Time Collision Detection, 5.1.5)
+  inline Feature closestOnTriangle(const Point& p, const Point& a, const Point& b, const Point& c, Point* q) {
+    Point ab = b - a, ac = c - a, ap = p - a;
+    float d1 = dot(ab, ap), d2 = dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) {
+      *q = a;
+      return CORNER_A;
+    }
+    Point bp = p - b;
+    float d3 = dot(ab, bp), d4 = dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) {
+      *q = b;
+      return CORNER_B;
+    }
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+      *q = a + (d1 / (d1 - d3)) * ab;
+      return EDGE_AB;
+    }
+    Point cp = p - c;
+    float d5 = dot(ab, cp), d6 = dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) {
+      *q = c;
+      return CORNER_C;
+    }
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+      *q = a + (d2 / (d2 - d6)) * ac;
+      return EDGE_CA;
+    }
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+      *q = b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b);
+      return EDGE_BC;
+    }
+    float denom = 1 / (va + vb + vc);
+    *q = a + (vb * denom) * ab + (vc * denom) * ac;
+    return FACE;
+  }
+
+  // squared distance from p to a box, 0 inside; NaN for a NaN p, which
+  // fails every test against it
+  inline float boxDistance2(const float* lo, const float* hi, const Point& p) {
+    float dx = max(max(lo[0] - p.x, p.x - hi[0]), 0.0f);
+    float dy = max(max(lo[1] - p.y, p.y - hi[1]), 0.0f);
+    float dz = max(max(lo[2] - p.z, p.z - hi[2]), 0.0f);
+    return dx * dx + dy * dy + dz * dz;
+  }
+
+  // the angle at corner a of the triangle abc
+  inline float cornerAngle(const Point& a, const Point& b, const Point& c) {
+    Point u = b - a, v = c - a;
+    return atan2(sqrt(dot(cross(u, v), cross(u, v))), dot(u, v));
+  }
+}
+
+void MeshCollider::build(const Surface& surface, float reach) {
+  this->reach = reach;
+  nodes.clear();
+  triangles.clear();
+  pseudonormals.clear();
+  sides.clear();
+
+  // one index per distinct position, so neighbouring faces share edges
+  // and corners even where the file repeats vertices
+  map<array<float, 3>, int> welded;
+  vector<int> weld(surface.VV.size());
+  vector<Point> positions;
+  for (size_t i = 0; i < surface.VV.size(); i++) {
+    array<float, 3> key = {{ surface.VV[i][0], surface.VV[i][1], surface.VV[i][2] }};
+    auto found = welded.insert(make_pair(key, (int) positions.size()));
+    if (found.second) {
+      positions.push_back(point(&key[0]));
+    }
+    weld[i] = found.first->second;
+  }
+  bool vertexNormals = surface.VN.size() == surface.VV.size();
+
+  // faces with area, wound outwards, and the sums of the pseudonormals
+  vector<array<int, 3> > faces;
+  vector<Point> faceNormals;
+  vector<Point> cornerSums(positions.size(), Point());
+  map<pair<int, int>, Point> edgeSums;
+  for (size_t f = 0; f < surface.VF.size(); f++) {
+    array<int, 3> v = {{ weld[surface.VF[f][0]], weld[surface.VF[f][1]], weld[surface.VF[f][2]] }};
+    Point a = positions[v[0]], b = positions[v[1]], c = positions[v[2]];
+    Point normal = cross(b - a, c - a);
+    if (!(dot(normal, normal) > 0)) {
+      continue;
+    }
+    if (vertexNormals) {
+      Vector3f given = surface.VN[surface.VF[f][0]] + surface.VN[surface.VF[f][1]] + surface.VN[surface.VF[f][2]];
+      if (dot(normal, point(&given[0])) < 0) {
+        swap(v[1], v[2]);
+        swap(b, c);
+        normal = -1 * normal;
+      }
+    }
+    normal = unit(normal);
+    faces.push_back(v);
+    faceNormals.push_back(normal);
+
+    cornerSums[v[0]] = cornerSums[v[0]] + cornerAngle(a, b, c) * normal;
+    cornerSums[v[1]] = cornerSums[v[1]] + cornerAngle(b, c, a) * normal;
+    cornerSums[v[2]] = cornerSums[v[2]] + cornerAngle(c, a, b) * normal;
+    for (int e = 0; e < 3; e++) {
+      pair<int, int> edge(min(v[e], v[(e + 1) % 3]), max(v[e], v[(e + 1) % 3]));
+      edgeSums[edge] = edgeSums[edge] + normal;
+    }
+  }
+  if (faces.empty()) {
+    return;
+  }
+
+  triangles.resize(faces.size());
+  pseudonormals.resize(faces.size());
+  vector<float> centroids(3 * faces.size());
+  for (size_t f = 0; f < faces.size(); f++) {
+    const array<int, 3>& v = faces[f];
+    Point a = positions[v[0]], b = positions[v[1]], c = positions[v[2]];
+    store(a, triangles[f].a);
+    store(b, triangles[f].b);
+    store(c, triangles[f].c);
+    store((1.0f / 3) * (a + b + c), &centroids[3 * f]);
+
+    Pseudonormals& normals = pseudonormals[f];
+    store(faceNormals[f], normals.face);
+    for (int e = 0; e < 3; e++) {
+      pair<int, int> edge(min(v[e], v[(e + 1) % 3]), max(v[e], v[(e + 1) % 3]));
+      store(unit(edgeSums[edge]), normals.edge[e]);
+      store(unit(cornerSums[v[e]]), normals.corner[e]);
+    }
+  }
+
+  vector<int> order(faces.size());
+  for (size_t f = 0; f < order.size(); f++) {
+    order[f] = f;
+  }
+  buildNode(order, centroids, 0, order.size());
+
+  // triangles in leaf order
+  vector<Triangle> sortedTriangles(order.size());
+  vector<Pseudonormals> sortedNormals(order.size());
+  for (size_t t = 0; t < order.size(); t++) {
+    sortedTriangles[t] = triangles[order[t]];
+    sortedNormals[t] = pseudonormals[order[t]];
+  }
+  triangles.swap(sortedTriangles);
+  pseudonormals.swap(sortedNormals);
+  buildSides();
+}
+
+int MeshCollider::buildNode(vector<int>& order, const vector<float>& centroids, int begin, int end) {
+  int index = nodes.size();
+  nodes.push_back(Node());
+
+  // bounds of the triangles and of their centroids
+  Node node;
+  float centerLo[3], centerHi[3];
+  for (int c = 0; c < 3; c++) {
+    node.lo[c] = centerLo[c] = INFINITY;
+    node.hi[c] = centerHi[c] = -INFINITY;
+  }
+  for (int k = begin; k < end; k++) {
+    const Triangle& t = triangles[order[k]];
+    for (int c = 0; c < 3; c++) {
+      node.lo[c] = min(node.lo[c], min(t.a[c], min(t.b[c], t.c[c])));
+      node.hi[c] = max(node.hi[c], max(t.a[c], max(t.b[c], t.c[c])));
+      centerLo[c] = min(centerLo[c], centroids[3 * order[k] + c]);
+      centerHi[c] = max(centerHi[c], centroids[3 * order[k] + c]);
+    }
+  }
+
+  if (end - begin <= LEAF_SIZE) {
+    node.offset = begin;
+    node.count = end - begin;
+    nodes[index] = node;
+    return index;
+  }
+
+  // halves along the longest side of the centroids, the first right
+  // after this node
+  int axis = 0;
+  for (int c = 1; c < 3; c++) {
+    if (centerHi[c] - centerLo[c] > centerHi[axis] - centerLo[axis]) {
+      axis = c;
+    }
+  }
+  int middle = (begin + end) / 2;
+  nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](int i, int j) {
+    return centroids[3 * i + axis] < centroids[3 * j + axis];
+  });
+  buildNode(order, centroids, begin, middle);
+  node.offset = buildNode(order, centroids, middle, end);
+  node.count = 0;
+  nodes[index] = node;
+  return index;
+}
+
+bool MeshCollider::load(const string& path, float reach) {
+  ifstream in(path.c_str());
+  Surface surface;
+  if (!in || !readObjFile(in, surface)) {
+    return false;
+  }
+  MeshCollider mesh;
+  mesh.build(surface, reach);
+  if (mesh.empty()) {
+    return false;
+  }
+  *this = mesh;
+  return true;
+}
+
+int MeshCollider::closestTriangle(const float* at, int start, float* best, float* closestPoint, int* feature) const {
+  Point p = point(at);
+  int closest = -1;
+  Point q = p;
+  Feature f = FACE;
+
+  // last time's closest triangle usually still is, and otherwise is
+  // near, so the search starts with a tight bound
+  if (start >= 0 && start < (int) triangles.size()) {
+    const Triangle& t = triangles[start];
+    Point r;
+    Feature rf = closestOnTriangle(p, point(t.a), point(t.b), point(t.c), &r);
+    float dist2 = dot(p - r, p - r);
+    if (dist2 < *best) {
+      *best = dist2;
+      closest = start;
+      f = rf;
+      q = r;
+    }
+  }
+
+  // nodes still to visit and their box distances, nearest on top
+  int stack[MAX_DEPTH];
+  float stackDistance[MAX_DEPTH];
+  int top = 0;
+  if (!nodes.empty()) {
+    stack[0] = 0;
+    stackDistance[0] = boxDistance2(nodes[0].lo, nodes[0].hi, p);
+    top = 1;
+  }
+  while (top > 0) {
+    top--;
+    if (!(stackDistance[top] < *best)) {
+      continue;
+    }
+    int index = stack[top];
+    const Node& node = nodes[index];
+    if (node.count > 0) {
+      for (int i = node.offset; i < node.offset + node.count; i++) {
+        if (i == start) {
+          continue;
+        }
+        const Triangle& t = triangles[i];
+        Point r;
+        Feature rf = closestOnTriangle(p, point(t.a), point(t.b), point(t.c), &r);
+        float dist2 = dot(p - r, p - r);
+        if (dist2 < *best) {
+          *best = dist2;
+          closest = i;
+          f = rf;
+          q = r;
+        }
+      }
+      continue;
+    }
+    int first = index + 1, second = node.offset;
+    float firstDistance = boxDistance2(nodes[first].lo, nodes[first].hi, p);
+    float secondDistance = boxDistance2(nodes[second].lo, nodes[second].hi, p);
+    if (firstDistance > secondDistance) {
+      swap(first, second);
+      swap(firstDistance, secondDistance);
+    }
+    if (secondDistance < *best) {
+      stack[top] = second;
+      stackDistance[top++] = secondDistance;
+    }
+    if (firstDistance < *best) {
+      stack[top] = first;
+      stackDistance[top++] = firstDistance;
+    }
+  }
+
+  store(q, closestPoint);
+  *feature = f;
+  return closest;
+}
+
+const float* MeshCollider::pseudonormal(int triangle, int feature) const {
+  const Pseudonormals& normals = pseudonormals[triangle];
+  return feature == FACE ? normals.face
+       : feature <= EDGE_CA ? normals.edge[feature - EDGE_AB]
+       : normals.corner[feature - CORNER_A];
+}
+
+void MeshCollider::query(int n, const float* x, const float* y, const float* z,
+                         float* d, float* nx, float* ny, float* nz, int* hint) const {
+  for (int k = 0; k < n; k++) {
+    float p[3] = { x[k], y[k], z[k] };
+    float q[3];
+    int feature;
+    // squared distance to beat: only what's within reach, unless the
+    // point may be inside, where anything counts
+    float best = reach * reach;
+    int closest = closestTriangle(p, hint ? hint[k] : -1, &best, q, &feature);
+    if (closest < 0 && side(p) <= 0) {
+      best = INFINITY;
+      closest = closestTriangle(p, -1, &best, q, &feature);
+    }
+    if (hint) {
+      hint[k] = closest;
+    }
+
+    Point e = point(p) - point(q);
+    bool inside = closest >= 0 && dot(e, point(pseudonormal(closest, feature))) < 0;
+    if (closest < 0 || (!inside && best > reach * reach)) {
+      d[k] = COLLIDER_FAR;
+      nx[k] = ny[k] = nz[k] = 0;
+      continue;
+    }
+    float dist = sqrt(best);
+    Point normal = dist > NORMAL_EPSILON ? (inside ? -1 / dist : 1 / dist) * e : point(pseudonormal(closest, feature));
+    d[k] = inside ? -dist : dist;
+    nx[k] = normal.x;
+    ny[k] = normal.y;
+    nz[k] = normal.z;
+  }
+}
+
+int MeshCollider::side(const float* p) const {
+  int cell[3];
+  for (int c = 0; c < 3; c++) {
+    float u = (p[c] - nodes[0].lo[c]) / sideCell;
+    // outside the bounds, or NaN
+    if (!(u >= 0 && u <= sideDims[c])) {
+      return 1;
+    }
+    cell[c] = min((int) u, sideDims[c] - 1);
+  }
+  return sides[(cell[2] * sideDims[1] + cell[1]) * sideDims[0] + cell[0]];
+}
+
+void MeshCollider::buildSides() {
+  // fine enough that no point beyond reach is in a cell the surface
+  // passes through, unless that makes too many
+  const Node& root = nodes[0];
+  float extent = max(root.hi[0] - root.lo[0], max(root.hi[1] - root.lo[1], root.hi[2] - root.lo[2]));
+  sideCell = max(reach / sqrt(3.0f), extent / MAX_SIDE_CELLS);
+  if (!(sideCell > 0)) {
+    sideCell = 1;
+  }
+  for (int c = 0; c < 3; c++) {
+    sideDims[c] = max(1, (int) ceil((root.hi[c] - root.lo[c]) / sideCell));
+  }
+  sides.resize(sideDims[0] * sideDims[1] * sideDims[2]);
+
+  // a cell whose centre is farther from the surface than its corners
+  // are from the centre is all on one side
+  float halfDiagonal = sideCell * sqrt(3.0f) / 2;
+  for (int k = 0; k < sideDims[2]; k++) {
+    for (int j = 0; j < sideDims[1]; j++) {
+      for (int i = 0; i < sideDims[0]; i++) {
+        float center[3] = { root.lo[0] + (i + 0.5f) * sideCell, root.lo[1] + (j + 0.5f) * sideCell,
+                            root.lo[2] + (k + 0.5f) * sideCell };
+        float q[3];
+        int feature;
+        float best = INFINITY;
+        int closest = closestTriangle(center, -1, &best, q, &feature);
+        Point e = point(center) - point(q);
+        bool inside = dot(e, point(pseudonormal(closest, feature))) < 0;
+        sides[(k * sideDims[1] + j) * sideDims[0] + i] = sqrt(best) <= halfDiagonal ? 0 : inside ? -1 : 1;
+      }
+    }
+  }
+}
+
+uint64_t MeshCollider::hash(uint64_t h) const {
+  h = hashBytes(&reach, sizeof(reach), h);
+  return triangles.empty() ? h : hashBytes(&triangles[0], triangles.size() * sizeof(Triangle), h);
+}
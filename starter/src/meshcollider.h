@@ -0,0 +1,92 @@
+#ifndef HAIR_SIMULATION_MESHCOLLIDER_H
+#define HAIR_SIMULATION_MESHCOLLIDER_H
+
+#include <string>
+#include <vector>
+#include "collider.h"
+
+struct Surface;
+
+// A collider given as a closed triangle mesh, with the distance to the
+// closest triangle found through a bounding volume hierarchy.
+//
+// The hierarchy is stored flat, depth first, 32 bytes a node: a node's
+// first child follows it and it keeps the index of the second, and the
+// triangles of every leaf are contiguous, so a lookup walks forwards
+// through two arrays. Outside the mesh only points within reach of the
+// surface get a distance, which keeps lookups away from it cheap, while
+// points inside always do, however deep; a coarse grid of which side of
+// the surface its cells are on tells the two apart without searching.
+// The closest triangle of each point is handed back as its hint and
+// tried first next time, which bounds the search from the start.
+//
+// Inside and outside come from the angle-weighted pseudonormal of the
+// closest feature (face, edge or vertex), which is exact for a closed,
+// consistently wound mesh.
+class MeshCollider : public Collider {
+public:
+  MeshCollider() : reach(0), sideCell(1) {
+    sideDims[0] = sideDims[1] = sideDims[2] = 0;
+  }
+
+  // Build the hierarchy over the triangles of surface. Vertices at the
+  // same position are welded; with a normal per vertex, faces wound
+  // against their normals are flipped, otherwise counter-clockwise is
+  // outside.
+  void build(const Surface& surface, float reach);
+  // an OBJ file as outputObjFile writes it; returns false, leaving the
+  // collider alone, if it can't be read or has no triangles
+  bool load(const std::string& path, float reach);
+
+  bool empty() const { return nodes.empty(); }
+
+  void query(int n, const float* x, const float* y, const float* z,
+             float* d, float* nx, float* ny, float* nz, int* hint) const override;
+  uint64_t hash(uint64_t h) const override;
+
+private:
+  struct Node {
+    float lo[3];
+    float hi[3];
+    // leaves: first triangle and count; inner nodes: second child and 0
+    int32_t offset;
+    int32_t count;
+  };
+  // corners, all a lookup reads for most triangles
+  struct Triangle {
+    float a[3];
+    float b[3];
+    float c[3];
+  };
+  // only read for the closest one: the pseudonormals of the face, the
+  // edges ab, bc, ca and the corners a, b, c
+  struct Pseudonormals {
+    float face[3];
+    float edge[3][3];
+    float corner[3][3];
+  };
+
+  // lay out the triangles order[begin, end) as a subtree, depth first
+  int buildNode(std::vector<int>& order, const std::vector<float>& centroids, int begin, int end);
+  void buildSides();
+
+  // The triangle closest to p if its squared distance is below best, or
+  // -1. Lowers best to it and returns the closest point on it and which
+  // feature that is on; start is tried first.
+  int closestTriangle(const float* p, int start, float* best, float* closestPoint, int* feature) const;
+  const float* pseudonormal(int triangle, int feature) const;
+  // which side of the surface p is on as far as the grid knows: -1
+  // inside, 1 outside (also beyond the bounds), 0 near the surface
+  int side(const float* p) const;
+
+  float reach;
+  std::vector<Node> nodes;
+  std::vector<Triangle> triangles;
+  std::vector<Pseudonormals> pseudonormals;
+  // the grid of sides over the bounds of the root, x fastest
+  int sideDims[3];
+  float sideCell;
+  std::vector<signed char> sides;
+};
+
+#endif //HAIR_SIMULATION_MESHCOLLIDER_H
@@ -14,6 +14,47 @@ float rand_uniform(float low, float hi) {
    return f;
 }
 
+std::vector<Vector3f> ParticleSystem::getState() const
+{
+    StateView s = view();
+    int n = s.numParticles();
+    std::vector<Vector3f> state(2 * n);
+    for (int i = 0; i < n; i++) {
+        state[2 * i] = s.position(i);
+        state[2 * i + 1] = s.velocity(i);
+    }
+    return state;
+}
+
+void ParticleSystem::setState(const std::vector<Vector3f>& newState)
+{
+    int n = m_numParticles;
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < 3; c++) {
+            m_state[c * n + i] = newState[2 * i][c];
+            m_state[(3 + c) * n + i] = newState[2 * i + 1][c];
+        }
+    }
+    invalidateAcceleration();
+}
+
+void ParticleSystem::evalF(const float* in, float* out, size_t n)
+{
+    int half = positionSize();
+    for (int i = 0; i < half; i++) {
+        out[i] = in[half + i];
+    }
+    evalAcceleration(in, in + half, out + half);
+}
+
+float* ParticleSystem::scratch(size_t n)
+{
+    if (m_scratch.size() < n) {
+        m_scratch.resize(n);
+    }
+    return m_scratch.data();
+}
+
 GLProgram::GLProgram(uint32_t apl, uint32_t apc, Camera* ac)
     : program_light(apl), program_color(apc), camera(ac) 
 {
@@ -4,28 +4,153 @@
 #include <vector>
 #include <vecmath.h>
 #include <cstdint>
+#include <cstddef>
 
 
 // helper for uniform distribution
 float rand_uniform(float low, float hi);
 
+// integrators with a statically dispatched version in integrators.h
+enum StepMethod {
+    STEP_FORWARD_EULER,
+    STEP_TRAPEZOIDAL,
+    STEP_RK4,
+    STEP_SYMPLECTIC_EULER,
+    STEP_VELOCITY_VERLET
+};
+
+// Read-only view of the state of a system, without copying it. It points
+// at the live state, so it sees every step and is valid as long as the
+// system is. Cheap enough to take by value wherever it is needed.
+class StateView
+{
+public:
+    StateView(const float* state, int numParticles) : m_state(state), m_n(numParticles) {}
+
+    int numParticles() const { return m_n; }
+    Vector3f position(int i) const { return Vector3f(m_state[i], m_state[m_n + i], m_state[2 * m_n + i]); }
+    Vector3f velocity(int i) const { return Vector3f(m_state[3 * m_n + i], m_state[4 * m_n + i], m_state[5 * m_n + i]); }
+
+    // one component of every particle, c = 0, 1, 2 for x, y, z
+    const float* positions(int c) const { return m_state + c * m_n; }
+    const float* velocities(int c) const { return m_state + (3 + c) * m_n; }
+
+private:
+    const float* m_state;
+    int m_n;
+};
+
+// Particles i and j kept restLength apart by position-based integration.
+// compliance is the inverse stiffness per unit mass, so a spring of
+// stiffness k between particles of mass m has m / k; 0 is inextensible.
+struct DistanceConstraint
+{
+    int i;
+    int j;
+    float restLength;
+    float compliance;
+};
+
 struct GLProgram;
+class BandedBlockMatrix;
 class ParticleSystem
 {
 public:
     virtual ~ParticleSystem() {}
 
-    // for a given state, evaluate derivative f(X,t)
-    virtual std::vector<Vector3f> evalF(std::vector<Vector3f> state) = 0;
+    // for a given state, evaluate derivative f(X,t).
+    // in and out both hold n = stateSize() floats in the slice layout
+    // described below; out must not alias in.
+    // The default copies the velocities and calls evalAcceleration.
+    virtual void evalF(const float* in, float* out, size_t n);
 
-    // getter method for the system's state
-    std::vector<Vector3f> getState() { return m_vVecState; };
+    // The same derivative split into its two halves: for positions x and
+    // velocities v (positionSize() floats each, x[n] y[n] z[n] layout)
+    // evaluate the accelerations a. Integrators that treat positions and
+    // velocities differently (symplectic Euler, Verlet) call this directly.
+    virtual void evalAcceleration(const float* x, const float* v, float* a) = 0;
+
+    // the state itself, for integrators to read and update in place:
+    // positionSize() floats of positions followed by the velocities
+    float* state() { return m_state; }
+    const float* state() const { return m_state; }
+    int stateSize() const { return sliceSize(m_numParticles); }
+    int positionSize() const { return 3 * m_numParticles; }
+
+    // Integrators that carry the last acceleration into the next step
+    // (velocity Verlet) keep it in scratch and may reuse it only while
+    // this flag is set. Whoever changes the state or the forces outside
+    // of the integrator must call invalidateAcceleration().
+    bool accelerationValid() const { return m_accelerationValid; }
+    void setAccelerationValid(bool valid) { m_accelerationValid = valid; }
+    void invalidateAcceleration() { m_accelerationValid = false; }
+
+    // Take one step of the given method through an integrator compiled
+    // together with this system's forces (see integrators.h), so the
+    // force evaluation is inlined instead of called virtually per stage.
+    // Returns false when the system has no such kernel, in which case
+    // the TimeStepper takes the generic path.
+    virtual bool takeStaticStep(StepMethod method, float stepSize) { return false; }
+
+    // Analytic Jacobians for implicit integrators, optional.
+    // jacobianBandwidth() is the largest index distance between two
+    // coupled particles, or -1 when the system doesn't provide them.
+    // evalJacobian() adds da/dx at state `in` to dadx and returns c such
+    // that da/dv = -c I. Pinned particles never move.
+    virtual int jacobianBandwidth() const { return -1; }
+    virtual float evalJacobian(const float* in, BandedBlockMatrix& dadx) { return 0; }
+    virtual bool isPinned(int i) const { return false; }
+
+    // Position-based integration, optional (see PositionBased).
+    // distanceConstraints() is null for systems without it. The
+    // inextensible constraints form chains with i leading j, listed so
+    // that every particle is placed before it leads another one.
+    // evalExternalAcceleration() is the acceleration from everything that
+    // isn't a constraint or a collision, and projectCollisions() moves
+    // particles at positions x out of any collider, projectCollision()
+    // just particle i.
+    virtual const std::vector<DistanceConstraint>* distanceConstraints() const { return nullptr; }
+    virtual void evalExternalAcceleration(const float* x, const float* v, float* a) {}
+    virtual void projectCollisions(float* x) const {}
+    virtual void projectCollision(float* x, int i) const {}
+
+    // Persistent scratch space of at least n floats for the integrator.
+    // It lives with the system rather than the integrator so one
+    // integrator can step many systems from several threads at once;
+    // after the first step of a given size it never allocates again.
+    float* scratch(size_t n);
+
+    // the state without copying it, for anything that only reads it
+    StateView view() const { return StateView(m_state, m_numParticles); }
+
+    // copy of the system's state,
+    // interleaved as (position 0, velocity 0, position 1, ...).
+    // Allocates every call; use view() to read the state.
+    std::vector<Vector3f> getState() const;
 
     // setter method for the system's state
-    void setState(const std::vector<Vector3f>  & newState) { m_vVecState = newState; };
+    void setState(const std::vector<Vector3f>  & newState);
+
+    int numParticles() const { return m_numParticles; }
+    Vector3f position(int i) const { return view().position(i); }
+    Vector3f velocity(int i) const { return view().velocity(i); }
+
+    // number of floats in the state slice of a system with n particles
+    static int sliceSize(int n) { return 6 * n; }
 
  protected:
-    std::vector<Vector3f> m_vVecState;
+    ParticleSystem() : m_state(nullptr), m_numParticles(0), m_accelerationValid(false) {}
+
+    // The state is not owned by the system: it points into a slice of
+    // a larger buffer (see HairGroup) laid out as structure of arrays,
+    //   x[n] y[n] z[n] vx[n] vy[n] vz[n]
+    // so loops over one component run through contiguous memory.
+    float* m_state;
+    int m_numParticles;
+
+private:
+    std::vector<float> m_scratch;
+    bool m_accelerationValid;
 };
 
 /* GLProgram is a helper for updating uniform variables.
@@ -0,0 +1,42 @@
+#ifndef HAIR_SIMULATION_SCALARLANES_H
+#define HAIR_SIMULATION_SCALARLANES_H
+
+#include <cmath>
+
+// The Lanes type the SIMD kernels (strandbatchkernel.h,
+// windfieldkernel.h, distancefieldkernel.h) are written over, for plain
+// floats one lane at a time: the reference the vector versions in
+// avx2lanes.h and avx512lanes.h are checked against. min and max return
+// b for NaN, as the vector instructions do.
+struct ScalarLanes {
+  typedef float V;
+  typedef int I;
+  typedef bool Mask;
+  static const int width = 1;
+
+  static V load(const float* p) { return *p; }
+  static void store(float* p, V a) { *p = a; }
+  static V set1(float a) { return a; }
+  static V add(V a, V b) { return a + b; }
+  static V sub(V a, V b) { return a - b; }
+  static V mul(V a, V b) { return a * b; }
+  static V div(V a, V b) { return a / b; }
+  static V sqrt(V a) { return std::sqrt(a); }
+  static V floor(V a) { return std::floor(a); }
+  static V min(V a, V b) { return a < b ? a : b; }
+  static V max(V a, V b) { return a > b ? a : b; }
+  static Mask less(V a, V b) { return a < b; }
+  static Mask equal(V a, V b) { return a == b; }
+  static Mask both(Mask a, Mask b) { return a && b; }
+  static V select(Mask m, V a, V b) { return m ? a : b; }
+
+  // integer lanes, for indices
+  static I seti(int a) { return a; }
+  static I addi(I a, I b) { return a + b; }
+  static I muli(I a, I b) { return a * b; }
+  static I toInt(V a) { return (int) a; }
+  static V toFloat(I a) { return (float) a; }
+  static V gather(const float* base, I index) { return base[index]; }
+};
+
+#endif //HAIR_SIMULATION_SCALARLANES_H
@@ -0,0 +1,70 @@
+#include "settlecache.h"
+#include "mappedfile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+namespace {
+  const char MAGIC[8] = { 'H', 'A', 'I', 'R', 'S', 'E', 'T', 'L' };
+  const uint32_t DATA_ALIGN = 64;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t h) {
+  const unsigned char* p = (const unsigned char*) data;
+  for (size_t i = 0; i < size; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+bool readSettleCache(const string& path, uint64_t key, float* state, size_t count, int* settled) {
+  MappedFile file;
+  if (!file.open(path) || file.size() < sizeof(SettleCacheHeader)) {
+    return false;
+  }
+  SettleCacheHeader header;
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != SETTLE_CACHE_VERSION ||
+      header.key != key || header.count != count ||
+      header.dataOffset < sizeof(header) || file.size() < header.dataOffset + count * sizeof(float)) {
+    return false;
+  }
+  memcpy(state, file.data() + header.dataOffset, count * sizeof(float));
+  *settled = header.settled;
+  return true;
+}
+
+bool writeSettleCache(const string& path, uint64_t key, const float* state, size_t count, int settled) {
+  SettleCacheHeader header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = SETTLE_CACHE_VERSION;
+  header.dataOffset = DATA_ALIGN;
+  header.key = key;
+  header.count = count;
+  header.settled = settled;
+  header.reserved = 0;
+
+  string temp = path + ".tmp";
+  {
+    ofstream out(temp.c_str(), ios::binary | ios::trunc);
+    vector<char> padding(header.dataOffset - sizeof(header), 0);
+    out.write((const char*) &header, sizeof(header));
+    out.write(&padding[0], padding.size());
+    out.write((const char*) state, count * sizeof(float));
+    if (!out) {
+      out.close();
+      remove(temp.c_str());
+      return false;
+    }
+  }
+#ifdef _WIN32
+  // rename doesn't replace an existing file there
+  remove(path.c_str());
+#endif
+  return rename(temp.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,46 @@
+#ifndef HAIR_SIMULATION_SETTLECACHE_H
+#define HAIR_SIMULATION_SETTLECACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The settled state of a hair group on disk, so an unchanged groom
+// starts without solving for its rest pose again (see HairGroup::settle).
+//
+// The file is a header followed by the state buffer exactly as
+// HairGroup keeps it, starting at a 64 byte aligned offset, so it can be
+// mapped and copied straight into place. The key is a hash of
+// everything the solve depends on; a file with another key or version
+// is a miss and gets replaced.
+
+// bump whenever the layout or the solver's results change
+const uint32_t SETTLE_CACHE_VERSION = 2;
+
+struct SettleCacheHeader {
+  // "HAIRSETL"
+  char magic[8];
+  uint32_t version;
+  // offset of the state from the start of the file
+  uint32_t dataOffset;
+  uint64_t key;
+  // number of floats in the state
+  uint64_t count;
+  // strands the solve got to rest, of those in the state
+  uint32_t settled;
+  uint32_t reserved;
+};
+
+// 64-bit FNV-1a, chained through h
+const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+uint64_t hashBytes(const void* data, size_t size, uint64_t h = FNV_OFFSET);
+
+// Copy count floats of cached state into state and the number of
+// settled strands into settled. Returns false, leaving both alone, unless
+// the file exists and matches key and count.
+bool readSettleCache(const std::string& path, uint64_t key, float* state, size_t count, int* settled);
+// Replace the cache file. It is written next to path and renamed over
+// it, so a reader never sees half a file.
+bool writeSettleCache(const std::string& path, uint64_t key, const float* state, size_t count, int settled);
+
+#endif //HAIR_SIMULATION_SETTLECACHE_H
@@ -0,0 +1,194 @@
+#include "simthread.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+  void sizeFrame(SimFrame& frame, const HairGroup* group) {
+    frame.state.assign(group->groupState().size(), 0.0f);
+    frame.renderPoints.assign(group->renderPointsSize(), 0.0f);
+    frame.previousState = frame.state;
+    frame.previousRenderPoints = frame.renderPoints;
+    frame.time = 0;
+    frame.due = 0;
+    frame.step = 0;
+    frame.dropped = 0;
+    frame.awake = 0;
+    frame.strainChecks = 0;
+    frame.strainClamps = 0;
+    frame.neighbourUpdates = 0;
+    frame.neighbourRebuilds = 0;
+  }
+}
+
+SimThread::SimThread(HairGroup* group, TimeStepper* timeStepper, float h, double frameBudget)
+  : group(group), timeStepper(timeStepper), h(h),
+    start(chrono::steady_clock::now()),
+    scheduler(timeStepper->isAdaptive() ? 0 : h, frameBudget), quit(false) {
+  // size every buffer up front, publishing never allocates
+  for (int i = 0; i < 3; i++) {
+    sizeFrame(frames.buffer(i), group);
+  }
+  sizeFrame(mix, group);
+  publish(0, 0, 0);
+  thread = std::thread(&SimThread::run, this);
+}
+
+SimThread::~SimThread() {
+  quit = true;
+  thread.join();
+}
+
+bool SimThread::post(const SimCommand& command) {
+  return commands.push(command);
+}
+
+const SimFrame& SimThread::latest() {
+  frames.update();
+  return frames.readBuffer();
+}
+
+const SimFrame& SimThread::blended() {
+  const SimFrame& frame = latest();
+  float alpha = 1;
+  if (frame.step > 0) {
+    alpha = (float) max(0.0, min(1.0, (clock() - frame.due) / frame.step));
+  }
+
+  for (size_t i = 0; i < frame.state.size(); i++) {
+    mix.state[i] = frame.previousState[i] + alpha * (frame.state[i] - frame.previousState[i]);
+  }
+  for (size_t i = 0; i < frame.renderPoints.size(); i++) {
+    mix.renderPoints[i] = frame.previousRenderPoints[i] +
+                          alpha * (frame.renderPoints[i] - frame.previousRenderPoints[i]);
+  }
+  mix.time = frame.time - (1 - alpha) * frame.step;
+  mix.due = frame.due;
+  mix.step = frame.step;
+  mix.dropped = frame.dropped;
+  mix.awake = frame.awake;
+  mix.strainChecks = frame.strainChecks;
+  mix.strainClamps = frame.strainClamps;
+  mix.neighbourUpdates = frame.neighbourUpdates;
+  mix.neighbourRebuilds = frame.neighbourRebuilds;
+  return mix;
+}
+
+double SimThread::clock() const {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void SimThread::run() {
+  double simulated = 0;
+  double last = clock();
+
+  while (!quit) {
+    applyCommands();
+
+    double now = clock();
+    double dt = now - last;
+    last = now;
+
+    if (timeStepper->isAdaptive()) {
+      // the integrator splits the interval into substeps itself,
+      // so advance in one call
+      double t = scheduler.advanceTime(dt);
+      if (t > 0) {
+        group->step(timeStepper, t);
+        simulated += t;
+        publish(simulated, 0, now);
+      }
+      this_thread::sleep_for(chrono::milliseconds(1));
+      continue;
+    }
+
+    int steps = scheduler.advance(dt);
+    if (steps == 0) {
+      // ahead of the clock: wait for the next step to come due
+      double wait = max(h - scheduler.leftover(), 0.0);
+      this_thread::sleep_for(chrono::duration<double>(min(wait, 0.001)));
+      continue;
+    }
+    for (int s = 0; s < steps; s++) {
+      if (s == steps - 1) {
+        capture(frames.writeBuffer(), true);
+      }
+      group->step(timeStepper, h);
+      simulated += h;
+    }
+    // the state is where the clock was, less what is left in the scheduler
+    publish(simulated, h, now - scheduler.leftover());
+  }
+}
+
+void SimThread::applyCommands() {
+  SimCommand command;
+  while (commands.pop(command)) {
+    switch (command.type) {
+      case SimCommand::SET_HAIR_CURVE:
+        group->setHairCurve(command.value);
+        break;
+      case SimCommand::SET_WIND_STRENGTH:
+        group->setWindStrength(command.value);
+        break;
+      case SimCommand::SET_WIND_DIRECTION:
+        group->setWindDirection(command.value);
+        break;
+      case SimCommand::TOGGLE_WIND:
+        group->toggleWind();
+        break;
+      case SimCommand::SET_FRAME_BUDGET:
+        scheduler.setBudget(command.value);
+        break;
+      case SimCommand::SET_STRAIN_LIMIT:
+        group->setStrainLimit(command.value);
+        break;
+      case SimCommand::SET_HAIR_COLLISION:
+        group->setHairCollision(command.value != 0);
+        break;
+      case SimCommand::SET_NEIGHBOUR_SKIN:
+        group->setNeighbourSkin(command.value);
+        break;
+      case SimCommand::SET_HAIR_VOLUME:
+        group->setHairVolume(command.value != 0);
+        break;
+      case SimCommand::SET_TURBULENT_WIND:
+        group->setTurbulentWind(command.value != 0);
+        break;
+      case SimCommand::SET_WIND_FALLOFF:
+        group->setWindFalloff(command.value);
+        break;
+    }
+  }
+}
+
+void SimThread::capture(SimFrame& frame, bool previous) {
+  vector<float>& state = previous ? frame.previousState : frame.state;
+  vector<float>& points = previous ? frame.previousRenderPoints : frame.renderPoints;
+  const vector<float>& current = group->groupState();
+  copy(current.begin(), current.end(), state.begin());
+  // the render hairs are blended here rather than on the render thread,
+  // which keeps the thread pool to this thread
+  group->interpolate(&state[0], &points[0]);
+}
+
+void SimThread::publish(double time, double step, double due) {
+  SimFrame& frame = frames.writeBuffer();
+  capture(frame, false);
+  if (step == 0) {
+    // nothing to blend from
+    frame.previousState = frame.state;
+    frame.previousRenderPoints = frame.renderPoints;
+  }
+  frame.time = time;
+  frame.due = due;
+  frame.step = step;
+  frame.dropped = scheduler.dropped();
+  frame.awake = group->awakeCount();
+  frame.strainChecks = group->strainChecks();
+  frame.strainClamps = group->strainClamps();
+  frame.neighbourUpdates = group->neighbourUpdates();
+  frame.neighbourRebuilds = group->neighbourRebuilds();
+  frames.publish();
+}
@@ -0,0 +1,130 @@
+#ifndef HAIR_SIMULATION_SIMTHREAD_H
+#define HAIR_SIMULATION_SIMTHREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "hairgroup.h"
+#include "timestepper.h"
+#include "spscqueue.h"
+#include "triplebuffer.h"
+#include "framescheduler.h"
+
+// a parameter change from the GUI, applied by the simulation thread
+struct SimCommand {
+  enum Type {
+    SET_HAIR_CURVE,
+    SET_WIND_STRENGTH,
+    SET_WIND_DIRECTION,
+    TOGGLE_WIND,
+    // most simulated seconds per frame, see FrameScheduler
+    SET_FRAME_BUDGET,
+    // see HairGroup::setStrainLimit
+    SET_STRAIN_LIMIT,
+    // see HairGroup::setHairCollision, on if value isn't 0
+    SET_HAIR_COLLISION,
+    // see HairGroup::setNeighbourSkin
+    SET_NEIGHBOUR_SKIN,
+    // see HairGroup::setHairVolume, on if value isn't 0
+    SET_HAIR_VOLUME,
+    // see HairGroup::setTurbulentWind, on if value isn't 0
+    SET_TURBULENT_WIND,
+    // see HairGroup::setWindFalloff
+    SET_WIND_FALLOFF
+  };
+
+  SimCommand() : type(TOGGLE_WIND), value(0) {}
+  SimCommand(Type type, float value = 0) : type(type), value(value) {}
+
+  Type type;
+  float value;
+};
+
+// everything the renderer needs from the last two steps of the simulation
+struct SimFrame {
+  // guide strands, laid out like HairGroup::groupState()
+  std::vector<float> state;
+  // render hairs, see HairGroup::interpolate()
+  std::vector<float> renderPoints;
+  // the same one step earlier
+  std::vector<float> previousState;
+  std::vector<float> previousRenderPoints;
+  // simulated seconds
+  double time;
+  // SimThread::clock() when the simulation reached state, and the step
+  // from previousState to it (0 when there is nothing to blend)
+  double due;
+  double step;
+  // real seconds dropped so far to stay within the frame budget
+  double dropped;
+  int awake;
+  // HairGroup::strainChecks() and strainClamps()
+  long strainChecks;
+  long strainClamps;
+  // HairGroup::neighbourUpdates() and neighbourRebuilds()
+  long neighbourUpdates;
+  long neighbourRebuilds;
+};
+
+// Runs a HairGroup in real time on its own thread. After every batch of
+// steps it publishes a SimFrame that the render thread picks up without
+// locking, and GUI changes reach it through a lock-free queue, so a slow
+// frame never holds up the simulation and a slow step never blocks the UI.
+// A FrameScheduler decides how many steps each batch takes.
+//
+// While it runs, the render thread must not touch the group's physics
+// state or call its setters directly; drawing-only state like the colors
+// is fine.
+class SimThread {
+public:
+  // h is the step size, or the largest substep for adaptive steppers
+  SimThread(HairGroup* group, TimeStepper* timeStepper, float h, double frameBudget = 0.1);
+  // stops the thread
+  ~SimThread();
+
+  // GUI thread only. Returns false when the queue is full.
+  bool post(const SimCommand& command);
+
+  // Render thread only: the latest published frame. The starting state
+  // is published before the thread starts, so there always is one. It
+  // stays valid until the next call.
+  const SimFrame& latest();
+
+  // Render thread only: the latest frame with state and renderPoints
+  // blended between its two steps by how far the clock has moved past
+  // the newer one, so motion stays smooth however the steps fall
+  // between frames. It is drawn one step behind the simulation.
+  const SimFrame& blended();
+
+  // seconds since the thread started
+  double clock() const;
+
+private:
+  SimThread(const SimThread&);
+  SimThread& operator=(const SimThread&);
+
+  void run();
+  void applyCommands();
+  // copy the group state into the frame being written, as its current
+  // or previous state
+  void capture(SimFrame& frame, bool previous);
+  void publish(double time, double step, double due);
+
+  HairGroup* group;
+  TimeStepper* timeStepper;
+  float h;
+  std::chrono::steady_clock::time_point start;
+  // sim thread only
+  FrameScheduler scheduler;
+
+  SpscQueue<SimCommand, 256> commands;
+  TripleBuffer<SimFrame> frames;
+  // render thread only, for blended()
+  SimFrame mix;
+
+  std::atomic<bool> quit;
+  std::thread thread;
+};
+
+#endif //HAIR_SIMULATION_SIMTHREAD_H
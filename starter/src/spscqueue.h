@@ -0,0 +1,46 @@
+#ifndef HAIR_SIMULATION_SPSCQUEUE_H
+#define HAIR_SIMULATION_SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// Fixed-size ring buffer for exactly one producer thread and one consumer
+// thread. Neither side ever locks or waits: push() fails when the queue
+// is full and pop() when it is empty. N must be a power of two.
+template <class T, size_t N>
+class SpscQueue {
+public:
+  SpscQueue() : head(0), tail(0) {}
+
+  // producer only
+  bool push(const T& item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    items[t & (N - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only
+  bool pop(T& item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = items[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+  T items[N];
+  // next slot to read and to write; they only ever grow
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+};
+
+#endif //HAIR_SIMULATION_SPSCQUEUE_H
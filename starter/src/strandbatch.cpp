@@ -0,0 +1,191 @@
+#include "strandbatch.h"
+#include "strandbatchkernel.h"
+#include "scalarlanes.h"
+#include "hairsystem.h"
+#include "integrators.h"
+
+#include <cmath>
+
+using namespace std;
+
+#ifdef HAIR_SIMD_X86
+// strandbatch_avx2.cpp and strandbatch_avx512.cpp
+void evalStrandBatchAvx2(int n, int width, const float* pos, const float* vel, float* acc,
+                         const StrandBatchForces& p, const float* contact, const float* external);
+void evalStrandBatchAvx512(int n, int width, const float* pos, const float* vel, float* acc,
+                           const StrandBatchForces& p, const float* contact, const float* external);
+#endif
+
+SimdLevel detectSimdLevel() {
+#ifdef HAIR_SIMD_X86
+  static const SimdLevel level =
+    __builtin_cpu_supports("avx512f") ? SIMD_AVX512 :
+    __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SCALAR;
+  return level;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+int simdWidth(SimdLevel level) {
+  switch (level) {
+    case SIMD_AVX512:
+      return 16;
+    case SIMD_AVX2:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+void evalStrandBatch(SimdLevel level, int n, int width, const float* pos, const float* vel,
+                     float* acc, const StrandBatchForces& p, const float* contact, const float* external) {
+  switch (level) {
+#ifdef HAIR_SIMD_X86
+    case SIMD_AVX512:
+      evalStrandBatchAvx512(n, width, pos, vel, acc, p, contact, external);
+      break;
+    case SIMD_AVX2:
+      evalStrandBatchAvx2(n, width, pos, vel, acc, p, contact, external);
+      break;
+#endif
+    default:
+      evalStrandBatchLanes<ScalarLanes>(n, width, pos, vel, acc, p, contact, external);
+      break;
+  }
+}
+
+bool StrandBatch::step(HairSystem* const* strands, int count, SimdLevel level, StepMethod method, float stepSize) {
+  int w = simdWidth(level);
+  if (count < 1 || count > w) {
+    return false;
+  }
+  for (int s = 1; s < count; s++) {
+    if (strands[s]->H != strands[0]->H || strands[s]->collider != strands[0]->collider ||
+        !strands[s]->external != !strands[0]->external) {
+      return false;
+    }
+  }
+
+  this->level = level;
+  this->count = count;
+  n = strands[0]->H;
+  width = w;
+  batchState.resize(stateSize());
+
+  // shared constants from the first strand, wind per lane
+  StrandForces first = strands[0]->strandForces();
+  for (int f = 0; f < 3; f++) {
+    forces.restLength[f] = first.restLength[f];
+    forces.stiffness[f] = first.stiffness[f];
+  }
+  forces.gravity = first.gravity;
+  forces.drag = first.drag;
+  forces.mass = first.mass;
+  forces.collision = first.collision;
+  collider = first.collider;
+  if (collider) {
+    contact.resize(4 * n * width);
+    contactHints.resize(n * width);
+  }
+  hasExternal = first.external != nullptr;
+  if (hasExternal) {
+    external.resize(3 * n * width);
+  }
+
+  // velocity Verlet starts from the acceleration of the last step if
+  // every strand still has it
+  bool carry = method == STEP_VELOCITY_VERLET;
+  carriedValid = carry;
+  for (int s = 0; s < count; s++) {
+    carriedValid = carriedValid && strands[s]->accelerationValid();
+  }
+  float* carried = scratch(positionSize());
+
+  fixed.clear();
+  for (int lane = 0; lane < width; lane++) {
+    HairSystem* strand = strands[min(lane, count - 1)];
+    StrandForces p = strand->strandForces();
+    for (int c = 0; c < 3; c++) {
+      forces.wind[c][lane] = p.wind[c];
+    }
+    for (size_t f = 0; f < strand->fixedPtIndex.size(); f++) {
+      fixed.push_back(strand->fixedPtIndex[f] * width + lane);
+    }
+
+    const float* src = strand->state();
+    for (int k = 0; k < 6 * n; k++) {
+      batchState[k * width + lane] = src[k];
+    }
+    if (collider) {
+      for (int i = 0; i < n; i++) {
+        contactHints[i * width + lane] = strand->contactHints[i];
+      }
+    }
+    if (hasExternal) {
+      for (int k = 0; k < 3 * n; k++) {
+        external[k * width + lane] = strand->external[k];
+      }
+    }
+    if (carriedValid) {
+      const float* a = strand->scratch(3 * n);
+      for (int k = 0; k < 3 * n; k++) {
+        carried[k * width + lane] = a[k];
+      }
+    }
+  }
+
+  staticStep(*this, method, stepSize);
+
+  for (int lane = 0; lane < count; lane++) {
+    float* dst = strands[lane]->state();
+    for (int k = 0; k < 6 * n; k++) {
+      dst[k] = batchState[k * width + lane];
+    }
+    if (collider) {
+      for (int i = 0; i < n; i++) {
+        strands[lane]->contactHints[i] = contactHints[i * width + lane];
+      }
+    }
+    if (carry && carriedValid) {
+      float* a = strands[lane]->scratch(3 * n);
+      for (int k = 0; k < 3 * n; k++) {
+        a[k] = carried[k * width + lane];
+      }
+      strands[lane]->setAccelerationValid(true);
+    } else {
+      strands[lane]->invalidateAcceleration();
+    }
+  }
+  return true;
+}
+
+float* StrandBatch::scratch(size_t size) {
+  if (batchScratch.size() < size) {
+    batchScratch.resize(size);
+  }
+  return &batchScratch[0];
+}
+
+void StrandBatch::evalAcceleration(const float* x, const float* v, float* a) {
+  int plane = n * width;
+  // every particle of every lane in one query
+  float* c = nullptr;
+  if (collider) {
+    c = &contact[0];
+    collider->query(plane, x, x + plane, x + 2 * plane, c, c + plane, c + 2 * plane, c + 3 * plane,
+                    &contactHints[0]);
+  }
+  evalStrandBatch(level, n, width, x, v, a, forces, c, hasExternal ? &external[0] : nullptr);
+  for (size_t i = 0; i < fixed.size(); i++) {
+    a[fixed[i]] = a[plane + fixed[i]] = a[2 * plane + fixed[i]] = 0;
+  }
+}
+
+void StrandBatch::evalF(const float* in, float* out, size_t size) {
+  size_t half = positionSize();
+  for (size_t i = 0; i < half; i++) {
+    out[i] = in[half + i];
+  }
+  evalAcceleration(in, in + half, out + half);
+}
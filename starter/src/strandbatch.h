@@ -0,0 +1,102 @@
+#ifndef HAIR_SIMULATION_STRANDBATCH_H
+#define HAIR_SIMULATION_STRANDBATCH_H
+
+#include <vector>
+#include "particlesystem.h"
+
+class HairSystem;
+class Collider;
+
+// Several strands of the same length stepped together, one strand per
+// SIMD lane.
+//
+// All guide strands have the same springs, so the force evaluation is the
+// same sequence of operations for each of them. A batch of width W packs
+// W strands so that every value of one particle sits in W consecutive
+// floats, one per strand:
+//   state[(c * n + i) * W + lane]   for component c = x y z vx vy vz
+// and the kernel then works on W strands with each vector instruction.
+// Every lane does the arithmetic of HairStrand<N> in the same order, so a
+// batch gives the same results as stepping the strands one by one.
+
+enum SimdLevel {
+  SIMD_SCALAR,
+  SIMD_AVX2,
+  SIMD_AVX512
+};
+
+// the widest level this CPU and build support, checked once
+SimdLevel detectSimdLevel();
+// strands per batch: 8 for AVX2, 16 for AVX-512, 1 for scalar
+int simdWidth(SimdLevel level);
+
+const int MAX_BATCH_WIDTH = 16;
+
+// parameters of a batch, shared by all lanes except for the wind
+struct StrandBatchForces {
+  float restLength[3];
+  float stiffness[3];
+  float gravity;
+  float drag;
+  float mass;
+  float collision;
+  // wind[c][lane]
+  float wind[3][MAX_BATCH_WIDTH];
+};
+
+// Accelerations of `width` strands of n particles in the batch layout.
+// pos, vel and acc each hold 3 * n * width floats. width must be a
+// multiple of simdWidth(level); the scalar level takes any width and is
+// the reference the vector versions are checked against. contact holds
+// Collider::query() at pos, distance then normal, in the same
+// layout (4 * n * width floats), or is null without a collider.
+// external is the strands' external acceleration, in the layout of acc,
+// or null.
+void evalStrandBatch(SimdLevel level, int n, int width, const float* pos, const float* vel,
+                     float* acc, const StrandBatchForces& p, const float* contact, const float* external);
+
+// Gathers count <= simdWidth(level) strands into the batch
+// layout, steps them with one of the explicit integrators and scatters
+// them back. Unused lanes get a copy of the last strand and are dropped.
+class StrandBatch {
+public:
+  StrandBatch() : level(SIMD_SCALAR), n(0), width(1), count(0), carriedValid(false), collider(nullptr), hasExternal(false) {}
+
+  // returns false when the strands can't be batched (different lengths
+  // or colliders, or only some with an external acceleration)
+  bool step(HairSystem* const* strands, int count, SimdLevel level, StepMethod method, float stepSize);
+
+  // what the integrator templates in integrators.h need
+  size_t stateSize() const { return 6 * n * width; }
+  size_t positionSize() const { return 3 * n * width; }
+  float* state() { return &batchState[0]; }
+  float* scratch(size_t size);
+  // the acceleration velocity Verlet carries over lives in the strands'
+  // own scratch between steps, so switching paths doesn't lose it
+  bool accelerationValid() const { return carriedValid; }
+  void setAccelerationValid(bool valid) { carriedValid = valid; }
+  void evalAcceleration(const float* x, const float* v, float* a);
+  void evalF(const float* in, float* out, size_t size);
+
+private:
+  SimdLevel level;
+  int n;
+  int width;
+  int count;
+  bool carriedValid;
+  StrandBatchForces forces;
+  const Collider* collider;
+  // collider lookups for the kernel, see evalStrandBatch, and the
+  // strands' hints for them in the batch layout
+  std::vector<float> contact;
+  std::vector<int> contactHints;
+  // the strands' external accelerations in the batch layout
+  bool hasExternal;
+  std::vector<float> external;
+  // fixed particles of every lane, as offsets into one component
+  std::vector<int> fixed;
+  std::vector<float> batchState;
+  std::vector<float> batchScratch;
+};
+
+#endif //HAIR_SIMULATION_STRANDBATCH_H
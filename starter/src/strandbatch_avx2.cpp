@@ -0,0 +1,14 @@
+// AVX2 version of the batch kernel, 8 strands per instruction.
+// Built with -mavx2 -ffp-contract=off and only called after
+// detectSimdLevel() has seen AVX2 on the CPU.
+#ifdef HAIR_SIMD_X86
+
+#include "avx2lanes.h"
+#include "strandbatchkernel.h"
+
+void evalStrandBatchAvx2(int n, int width, const float* pos, const float* vel, float* acc,
+                         const StrandBatchForces& p, const float* contact, const float* external) {
+  evalStrandBatchLanes<Avx2Lanes>(n, width, pos, vel, acc, p, contact, external);
+}
+
+#endif
@@ -0,0 +1,14 @@
+// AVX-512 version of the batch kernel, 16 strands per instruction.
+// Built with -mavx512f -ffp-contract=off and only called after
+// detectSimdLevel() has seen AVX-512F on the CPU.
+#ifdef HAIR_SIMD_X86
+
+#include "avx512lanes.h"
+#include "strandbatchkernel.h"
+
+void evalStrandBatchAvx512(int n, int width, const float* pos, const float* vel, float* acc,
+                           const StrandBatchForces& p, const float* contact, const float* external) {
+  evalStrandBatchLanes<Avx512Lanes>(n, width, pos, vel, acc, p, contact, external);
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef HAIR_SIMULATION_STRANDBATCHKERNEL_H
+#define HAIR_SIMULATION_STRANDBATCHKERNEL_H
+
+#include "strandbatch.h"
+
+// The batch force kernel, written once over a Lanes type that wraps one
+// instruction set (scalarlanes.h, avx2lanes.h and avx512lanes.h):
+//   V, Mask, width, load, store, set1, add, sub, mul, div, sqrt,
+//   less(a, b) and select(mask, ifTrue, ifFalse)
+// It is included by strandbatch.cpp for the scalar reference and by one
+// file per instruction set, each compiled with that set enabled.
+// The operations follow HairStrand<N>::evalAcceleration one for one.
+// contact is the collider looked up at every particle beforehand and
+// external the strands' external acceleration, see evalStrandBatch.
+
+template <class L>
+void evalStrandBatchLanes(int n, int width, const float* pos, const float* vel, float* acc,
+                          const StrandBatchForces& p, const float* contact, const float* external) {
+  typedef typename L::V V;
+  typedef typename L::Mask Mask;
+  // one component of every particle of every lane
+  int plane = n * width;
+
+  const V negDrag = L::set1(-p.drag);
+  const V negGravity = L::set1(-p.gravity);
+  const V mass = L::set1(p.mass);
+  const V zero = L::set1(0);
+  const V collision = L::set1(p.collision);
+
+  for (int lane = 0; lane < width; lane += L::width) {
+    const V windX = L::load(&p.wind[0][lane]);
+    const V windY = L::load(&p.wind[1][lane]);
+    const V windZ = L::load(&p.wind[2][lane]);
+
+    // gravity, drag, collision, wind and anything external
+    for (int i = 0; i < n; i++) {
+      int k = i * width + lane;
+      V fx = L::div(L::mul(L::load(vel + k), negDrag), mass);
+      V fy = L::add(negGravity, L::div(L::mul(L::load(vel + plane + k), negDrag), mass));
+      V fz = L::div(L::mul(L::load(vel + 2 * plane + k), negDrag), mass);
+
+      if (contact) {
+        Mask inside = L::less(L::load(contact + k), zero);
+        V nx = L::load(contact + plane + k);
+        V ny = L::load(contact + 2 * plane + k);
+        V nz = L::load(contact + 3 * plane + k);
+        fx = L::select(inside, L::add(fx, L::mul(nx, collision)), fx);
+        fy = L::select(inside, L::add(fy, L::mul(ny, collision)), fy);
+        fz = L::select(inside, L::add(fz, L::mul(nz, collision)), fz);
+      }
+
+      if (i > n / 2) {
+        V w = L::set1(i > n * 3 / 4 ? 2.0f : 1.0f);
+        fx = L::add(fx, L::mul(windX, w));
+        fy = L::add(fy, L::mul(windY, w));
+        fz = L::add(fz, L::mul(windZ, w));
+      }
+
+      if (external) {
+        fx = L::add(fx, L::load(external + k));
+        fy = L::add(fy, L::load(external + plane + k));
+        fz = L::add(fz, L::load(external + 2 * plane + k));
+      }
+      L::store(acc + k, fx);
+      L::store(acc + plane + k, fy);
+      L::store(acc + 2 * plane + k, fz);
+    }
+
+    // the three spring families, in the order of the spring list
+    for (int f = 0; f < 3; f++) {
+      int stride = f + 1;
+      const V negStiffness = L::set1(-p.stiffness[f]);
+      const V restLength = L::set1(p.restLength[f]);
+      for (int i = 0; i + stride < n; i++) {
+        int k = i * width + lane;
+        int l = (i + stride) * width + lane;
+        V dx = L::sub(L::load(pos + k), L::load(pos + l));
+        V dy = L::sub(L::load(pos + plane + k), L::load(pos + plane + l));
+        V dz = L::sub(L::load(pos + 2 * plane + k), L::load(pos + 2 * plane + l));
+        V len = L::sqrt(L::add(L::add(L::mul(dx, dx), L::mul(dy, dy)), L::mul(dz, dz)));
+        V s = L::mul(negStiffness, L::sub(len, restLength));
+        V fx = L::div(L::mul(L::div(dx, len), s), mass);
+        V fy = L::div(L::mul(L::div(dy, len), s), mass);
+        V fz = L::div(L::mul(L::div(dz, len), s), mass);
+        L::store(acc + k, L::add(L::load(acc + k), fx));
+        L::store(acc + plane + k, L::add(L::load(acc + plane + k), fy));
+        L::store(acc + 2 * plane + k, L::add(L::load(acc + 2 * plane + k), fz));
+        L::store(acc + l, L::sub(L::load(acc + l), fx));
+        L::store(acc + plane + l, L::sub(L::load(acc + plane + l), fy));
+        L::store(acc + 2 * plane + l, L::sub(L::load(acc + 2 * plane + l), fz));
+      }
+    }
+  }
+}
+
+#endif //HAIR_SIMULATION_STRANDBATCHKERNEL_H
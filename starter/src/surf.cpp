@@ -1,5 +1,7 @@
 #include "surf.h"
 #include "vertexrecorder.h"
+#include <cstdlib>
+#include <sstream>
 using namespace std;
 
 const float c_pi = 3.14159265358979323846f;
@@ -143,3 +145,38 @@ void outputObjFile(ostream &out, const Surface &surface)
         out << endl;
     }
 }
+
+bool readObjFile(istream &in, Surface &surface)
+{
+    string line;
+    while (getline(in, line))
+    {
+        istringstream ss(line);
+        string type;
+        ss >> type;
+        if (type == "v" || type == "vn")
+        {
+            Vector3f v;
+            ss >> v[0] >> v[1] >> v[2];
+            (type == "v" ? surface.VV : surface.VN).push_back(v);
+        }
+        else if (type == "f")
+        {
+            // "a", "a/t", "a//n" or "a/t/n"; the part before the first / is the vertex
+            vector<unsigned> corners;
+            string corner;
+            while (ss >> corner)
+            {
+                int index = atoi(corner.c_str());
+                int count = (int)surface.VV.size();
+                index = index < 0 ? count + index : index - 1;
+                if (index < 0 || index >= count)
+                    return false;
+                corners.push_back(index);
+            }
+            for (unsigned i=2; i<corners.size(); i++)
+                surface.VF.push_back(Tup3u(corners[0], corners[i-1], corners[i]));
+        }
+    }
+    return true;
+}
@@ -33,6 +33,13 @@ Surface makeGenCyl( const Curve& profile, const Curve& sweep );
 
 void outputObjFile( std::ostream& out, const Surface& surface );
 
+// Read the vertices, normals and faces of an OBJ file into surface, as
+// outputObjFile writes them: v, vn and f lines with 1-based (or
+// negative, relative) indices, of which only the vertex index of each
+// corner is used. Polygons are split into fans of triangles. Returns
+// false on a face that refers to a missing vertex.
+bool readObjFile( std::istream& in, Surface& surface );
+
 // Record the surface vertices. 
 void recordSurface( const Surface& surface, VertexRecorder* recorder, Vector3f COLOR);
 
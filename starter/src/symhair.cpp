@@ -8,31 +8,21 @@
 
 using namespace std;
 
-SymHair::SymHair(Vector3f origin_input,
-        vector<HairSystem*> hair_inputs,
-        vector<float> weight_inputs) {
-  origin = origin_input;
-  hairs = hair_inputs;
-  weights = weight_inputs;
+SymHair::SymHair(int length_input) {
+  length = length_input;
   hairColor = Vector3f(0.642589, 0.347272, 0.211211);
 }
 
-void SymHair::draw(GLProgram& gl, VertexRecorder curveRec, VertexRecorder surfaceRec) {
+void SymHair::draw(GLProgram& gl, VertexRecorder curveRec, VertexRecorder surfaceRec, const float* points) {
   gl.disableLighting();
   gl.updateModelMatrix(Matrix4f::identity());
-  vector<Vector3f> points;
-  points.push_back(origin);
-
-  int hair_len = (hairs[0]->getState()).size() / 2;
-  for (int i = 1; i < hair_len; i++) {
-    Vector3f point = Vector3f::ZERO;
-    for (int j = 0; j < hairs.size(); j++) {
-      point += hairs[j]->getState()[2 * i] * weights[j];
-    }
-    points.push_back(point);
+  vector<Vector3f> controlPoints;
+  controlPoints.reserve(length);
+  for (int i = 0; i < length; i++) {
+    controlPoints.push_back(Vector3f(points[i], points[length + i], points[2 * length + i]));
   }
 
-  Curve curve = evalBspline(points, 8);
+  Curve curve = evalBspline(controlPoints, 8);
   recordCurve(curve, &curveRec);
   glLineWidth(1.0f);
   // curveRec.draw(GL_LINES);
@@ -8,16 +8,17 @@
 
 using namespace std;
 
+// An interpolated render hair. HairGroup blends its control points from
+// the guides (see HairGroup::interpolate); the hair only draws them.
 class SymHair {
 public:
-  SymHair(Vector3f origin, vector<HairSystem *> hairs, vector<float> weights);
-  void draw(GLProgram& ctx, VertexRecorder curveRec, VertexRecorder surfaceRec);
+  SymHair(int length);
+  // points: x[length] y[length] z[length]
+  void draw(GLProgram& ctx, VertexRecorder curveRec, VertexRecorder surfaceRec, const float* points);
   void setHairColor(float r, float g, float b);
 
 private:
-  Vector3f origin;
-  vector<HairSystem*> hairs;
-  vector<float> weights;
+  int length;
   Vector3f hairColor;
 };
 
@@ -0,0 +1,107 @@
+#include "threadpool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threadCount)
+  : job(nullptr), jobCount(0), jobGrain(1), nextChunk(0),
+    busyWorkers(0), generation(0), quit(false) {
+  start(threadCount);
+}
+
+ThreadPool::~ThreadPool() {
+  stop();
+}
+
+void ThreadPool::setThreadCount(int threadCount) {
+  stop();
+  start(threadCount);
+}
+
+void ThreadPool::start(int threadCount) {
+  if (threadCount <= 0) {
+    threadCount = (int) thread::hardware_concurrency();
+  }
+  if (threadCount < 1) {
+    threadCount = 1;
+  }
+
+  quit = false;
+  for (int i = 0; i < threadCount - 1; i++) {
+    // hand over the current generation so a job posted before the
+    // thread gets scheduled is not mistaken for one already done
+    workers.push_back(thread(&ThreadPool::workerLoop, this, generation));
+  }
+}
+
+void ThreadPool::stop() {
+  {
+    lock_guard<mutex> lock(jobMutex);
+    quit = true;
+  }
+  wake.notify_all();
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+  workers.clear();
+}
+
+void ThreadPool::parallelFor(int count, int grain, const function<void(int, int)>& fn) {
+  if (count <= 0) {
+    return;
+  }
+  if (grain < 1) {
+    grain = 1;
+  }
+  // serial fallback: no workers, or not enough work to split
+  if (workers.empty() || count <= grain) {
+    fn(0, count);
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(jobMutex);
+    job = &fn;
+    jobCount = count;
+    jobGrain = grain;
+    nextChunk = 0;
+    busyWorkers = (int) workers.size();
+    generation++;
+  }
+  wake.notify_all();
+
+  runChunks();
+
+  unique_lock<mutex> lock(jobMutex);
+  done.wait(lock, [this] { return busyWorkers == 0; });
+  job = nullptr;
+}
+
+void ThreadPool::runChunks() {
+  int chunks = (jobCount + jobGrain - 1) / jobGrain;
+  for (int c = nextChunk++; c < chunks; c = nextChunk++) {
+    int begin = c * jobGrain;
+    int end = min(begin + jobGrain, jobCount);
+    (*job)(begin, end);
+  }
+}
+
+void ThreadPool::workerLoop(unsigned long seen) {
+  while (true) {
+    {
+      unique_lock<mutex> lock(jobMutex);
+      wake.wait(lock, [this, seen] { return quit || generation != seen; });
+      if (quit) {
+        return;
+      }
+      seen = generation;
+    }
+
+    runChunks();
+
+    {
+      lock_guard<mutex> lock(jobMutex);
+      busyWorkers--;
+    }
+    done.notify_one();
+  }
+}
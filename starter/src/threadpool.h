@@ -0,0 +1,52 @@
+#ifndef HAIR_SIMULATION_THREADPOOL_H
+#define HAIR_SIMULATION_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small persistent worker pool. Threads are created once and sleep
+// between jobs, so handing out work every time step costs a wake-up
+// instead of a thread spawn.
+class ThreadPool {
+public:
+  // threadCount counts the calling thread too; 0 picks one per core.
+  explicit ThreadPool(int threadCount = 0);
+  ~ThreadPool();
+
+  // Run fn(begin, end) over [0, count) in chunks of at most grain items.
+  // The calling thread works along and the call returns once every chunk
+  // is done. With a single thread this is a plain serial loop.
+  void parallelFor(int count, int grain, const std::function<void(int, int)>& fn);
+
+  void setThreadCount(int threadCount);
+  int threadCount() const { return (int) workers.size() + 1; }
+
+private:
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+
+  void start(int threadCount);
+  void stop();
+  void workerLoop(unsigned long seen);
+  void runChunks();
+
+  std::vector<std::thread> workers;
+  std::mutex jobMutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+
+  // current job, guarded by mutex except for the atomics
+  const std::function<void(int, int)>* job;
+  int jobCount;
+  int jobGrain;
+  std::atomic<int> nextChunk;
+  int busyWorkers;
+  unsigned long generation;
+  bool quit;
+};
+
+#endif //HAIR_SIMULATION_THREADPOOL_H
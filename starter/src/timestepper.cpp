@@ -1,64 +1,330 @@
 #include "timestepper.h"
 
+#include "bandedmatrix.h"
+#include "integrators.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 
+// The explicit integrators live in integrators.h. Each takeStep is a thin
+// adapter: it runs the kernel the system compiled for itself if it has
+// one, and the generic template over the virtual interface otherwise.
+
 void ForwardEuler::takeStep(ParticleSystem* particleSystem, float stepSize)
 {
-    // cout << "use Euler" << endl;
-    std::vector<Vector3f> oldState = particleSystem -> getState();
-    std::vector<Vector3f> f = particleSystem -> evalF(oldState);
-    std::vector<Vector3f> newState;
-    for (int i = 0; i < oldState.size(); i++) {
-	   newState.push_back(oldState[i] + stepSize * f[i]);
-    }
-    particleSystem -> setState(newState);
+    if (!particleSystem -> takeStaticStep(STEP_FORWARD_EULER, stepSize)) {
+        DynamicSystem system(particleSystem);
+        forwardEulerStep(system, stepSize);
+    }
 }
 
 void Trapezoidal::takeStep(ParticleSystem* particleSystem, float stepSize)
 {
-    // cout << "use Trapezoidal" << endl;
-	std::vector<Vector3f> oldState = particleSystem -> getState();
-	std::vector<Vector3f> f0 = particleSystem -> evalF(oldState);
-	std::vector<Vector3f> state1;
-    for (int i = 0; i < oldState.size(); i++) {
-	   state1.push_back(oldState[i] + stepSize * f0[i]);
+    if (!particleSystem -> takeStaticStep(STEP_TRAPEZOIDAL, stepSize)) {
+        DynamicSystem system(particleSystem);
+        trapezoidalStep(system, stepSize);
     }
-    std::vector<Vector3f> f1 = particleSystem -> evalF(state1);
+}
 
-    std::vector<Vector3f> newState;
-    for (int i = 0; i < oldState.size(); i++) {
-	   newState.push_back(oldState[i] + 0.5 * stepSize * (f0[i] + f1[i]));
+void RK4::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+    if (!particleSystem -> takeStaticStep(STEP_RK4, stepSize)) {
+        DynamicSystem system(particleSystem);
+        rk4Step(system, stepSize);
     }
-    particleSystem -> setState(newState);
 }
 
+void ImplicitEuler::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+    int particles = particleSystem -> numParticles();
+    size_t n = particleSystem -> stateSize();
+    int bandwidth = particleSystem -> jacobianBandwidth();
+    float h = stepSize;
 
-void RK4::takeStep(ParticleSystem* particleSystem, float stepSize)
+    float* state = particleSystem -> state();
+    float* x = state;
+    float* v = state + 3 * particles;
+    size_t matrixSize = bandwidth < 0 ? 0 : BandedBlockMatrix::storageSize(particles, bandwidth);
+    float* f = particleSystem -> scratch(n + 3 * particles + matrixSize);
+    float* a = f + 3 * particles;
+    float* r = f + n;
+
+    particleSystem -> evalF(state, f, n);
+
+    bool solved = false;
+    if (bandwidth >= 0) {
+        BandedBlockMatrix A(r + 3 * particles, particles, bandwidth);
+        A.clear();
+        float c = particleSystem -> evalJacobian(state, A);
+
+        // A = (1 + h c) I - h^2 da/dx
+        A.scale(-h * h);
+        for (int i = 0; i < particles; i++) {
+            A.addDiagonal(i, 1 + h * c);
+        }
+        for (int i = 0; i < 3 * particles; i++) {
+            r[i] = v[i] + h * (a[i] + c * v[i]);
+        }
+        for (int i = 0; i < particles; i++) {
+            if (particleSystem -> isPinned(i)) {
+                A.pin(i);
+                r[i] = r[particles + i] = r[2 * particles + i] = 0;
+            }
+        }
+
+        if (A.factor()) {
+            A.solve(r, r + particles, r + 2 * particles);
+            for (int i = 0; i < 3 * particles; i++) {
+                v[i] = r[i];
+            }
+            solved = true;
+        }
+    }
+
+    if (!solved) {
+        for (int i = 0; i < 3 * particles; i++) {
+            v[i] += h * a[i];
+        }
+    }
+
+    for (int i = 0; i < 3 * particles; i++) {
+        x[i] += h * v[i];
+    }
+}
+void SymplecticEuler::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+    if (!particleSystem -> takeStaticStep(STEP_SYMPLECTIC_EULER, stepSize)) {
+        DynamicSystem system(particleSystem);
+        symplecticEulerStep(system, stepSize);
+    }
+}
+
+void VelocityVerlet::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+    if (!particleSystem -> takeStaticStep(STEP_VELOCITY_VERLET, stepSize)) {
+        DynamicSystem system(particleSystem);
+        velocityVerletStep(system, stepSize);
+    }
+}
+
+namespace
+{
+// One XPBD projection of constraint c on positions p (x[n] y[n] z[n])
+// with inverse masses w: lambda is the constraint's multiplier so far
+// this step and alpha its compliance over h^2.
+void projectDistance(float* p, const float* w, int n, const DistanceConstraint& c, float alpha, float& lambda)
+{
+    Vector3f d(p[c.j] - p[c.i], p[n + c.j] - p[n + c.i], p[2 * n + c.j] - p[2 * n + c.i]);
+    float wSum = w[c.i] + w[c.j];
+    float len = d.abs();
+    if (wSum == 0 || len < 1e-6f) {
+        return;
+    }
+    float dLambda = (c.restLength - len - alpha * lambda) / (wSum + alpha);
+    lambda += dLambda;
+    Vector3f u = d / len;
+    for (int k = 0; k < 3; k++) {
+        p[k * n + c.i] -= w[c.i] * dLambda * u[k];
+        p[k * n + c.j] += w[c.j] * dLambda * u[k];
+    }
+}
+
+// part of the pull of its follower a particle's velocity gives back
+const float FTL_DAMPING = 0.9f;
+}
+
+PositionBased::PositionBased(Mode mode, int iterations) :
+    mode(mode),
+    iterations(iterations)
+{
+}
+
+void PositionBased::takeStep(ParticleSystem* particleSystem, float stepSize)
 {
-    std::vector<Vector3f> oldState = particleSystem -> getState();
-    std::vector<Vector3f> k1 = particleSystem -> evalF(oldState);
-    std::vector<Vector3f> s2;
-    for (int i = 0; i < oldState.size(); i++) {
-       s2.push_back(oldState[i] + 0.5 * stepSize * k1[i]);
+    const std::vector<DistanceConstraint>* constraints = particleSystem -> distanceConstraints();
+    if (!constraints) {
+        DynamicSystem system(particleSystem);
+        symplecticEulerStep(system, stepSize);
+        return;
     }
-    std::vector<Vector3f> k2 = particleSystem -> evalF(s2);
 
-    std::vector<Vector3f> s3;
-    for (int i = 0; i < oldState.size(); i++) {
-       s3.push_back(oldState[i] + 0.5 * stepSize * k2[i]);
+    int n = particleSystem -> numParticles();
+    int m = constraints -> size();
+    float h = stepSize;
+    float* x = particleSystem -> state();
+    float* v = x + 3 * n;
+    float* a = particleSystem -> scratch(10 * n + m);
+    float* p = a + 3 * n;
+    // inverse masses, 0 for pinned particles; the compliances are per
+    // unit mass, so 1 for the others
+    float* w = p + 3 * n;
+    // how far each particle's follower was moved by the chain pass
+    float* follow = w + n;
+    float* lambda = follow + 3 * n;
+
+    // move freely under the external forces
+    particleSystem -> evalExternalAcceleration(x, v, a);
+    for (int i = 0; i < n; i++) {
+        w[i] = particleSystem -> isPinned(i) ? 0 : 1;
+    }
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < n; i++) {
+            int k = c * n + i;
+            v[k] += w[i] * h * a[k];
+            p[k] = x[k] + w[i] * h * v[k];
+            follow[k] = 0;
+        }
+    }
+    for (int k = 0; k < m; k++) {
+        lambda[k] = 0;
     }
-    std::vector<Vector3f> k3 = particleSystem -> evalF(s3);
 
-    std::vector<Vector3f> s4;
-    for (int i = 0; i < oldState.size(); i++) {
-       s4.push_back(oldState[i] + stepSize * k3[i]);
+    if (mode == GAUSS_SEIDEL) {
+        for (int it = 0; it < iterations; it++) {
+            for (int k = 0; k < m; k++) {
+                const DistanceConstraint& c = (*constraints)[k];
+                projectDistance(p, w, n, c, c.compliance / (h * h), lambda[k]);
+            }
+            particleSystem -> projectCollisions(p);
+        }
+    } else {
+        for (int k = 0; k < m; k++) {
+            const DistanceConstraint& c = (*constraints)[k];
+            if (c.compliance > 0) {
+                projectDistance(p, w, n, c, c.compliance / (h * h), lambda[k]);
+            }
+        }
+        particleSystem -> projectCollisions(p);
+
+        // the follower moves all the way, the leader not at all
+        for (int k = 0; k < m; k++) {
+            const DistanceConstraint& c = (*constraints)[k];
+            Vector3f d(p[c.j] - p[c.i], p[n + c.j] - p[n + c.i], p[2 * n + c.j] - p[2 * n + c.i]);
+            float len = d.abs();
+            if (c.compliance > 0 || w[c.j] == 0 || len < 1e-6f) {
+                continue;
+            }
+            Vector3f correction = (c.restLength / len - 1) * d;
+            for (int r = 0; r < 3; r++) {
+                p[r * n + c.j] += correction[r];
+                follow[r * n + c.i] += correction[r];
+            }
+            // out of colliders before it leads anything
+            particleSystem -> projectCollision(p, c.j);
+        }
     }
-    std::vector<Vector3f> k4 = particleSystem -> evalF(s4);
 
-    std::vector<Vector3f> newState;
-    for (int i = 0; i < oldState.size(); i++) {
-       newState.push_back(oldState[i] + (1.0 / 6.0) * stepSize * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]));
+    // The velocity is how far the particle got. In FTL the leader never
+    // feels its follower being pulled in, so most of that pull is taken
+    // off the leader's velocity instead.
+    float damping = mode == FOLLOW_THE_LEADER ? FTL_DAMPING : 0;
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < n; i++) {
+            int k = c * n + i;
+            v[k] = w[i] * (p[k] - x[k] - damping * follow[k]) / h;
+            x[k] = p[k];
+        }
     }
-    particleSystem -> setState(newState);
 }
 
+namespace
+{
+// Dormand-Prince tableau
+const float A21 = 1.0 / 5.0;
+const float A31 = 3.0 / 40.0, A32 = 9.0 / 40.0;
+const float A41 = 44.0 / 45.0, A42 = -56.0 / 15.0, A43 = 32.0 / 9.0;
+const float A51 = 19372.0 / 6561.0, A52 = -25360.0 / 2187.0, A53 = 64448.0 / 6561.0, A54 = -212.0 / 729.0;
+const float A61 = 9017.0 / 3168.0, A62 = -355.0 / 33.0, A63 = 46732.0 / 5247.0, A64 = 49.0 / 176.0, A65 = -5103.0 / 18656.0;
+// 5th order weights, also the last row of the tableau
+const float B1 = 35.0 / 384.0, B3 = 500.0 / 1113.0, B4 = 125.0 / 192.0, B5 = -2187.0 / 6784.0, B6 = 11.0 / 84.0;
+// difference between the 5th and the embedded 4th order weights
+const float E1 = 71.0 / 57600.0, E3 = -71.0 / 16695.0, E4 = 71.0 / 1920.0, E5 = -17253.0 / 339200.0, E6 = 22.0 / 525.0, E7 = -1.0 / 40.0;
+
+// substeps shorter than this are accepted regardless of the error
+const float MIN_STEP = 1e-6f;
+}
+
+DormandPrince::DormandPrince(float maxStep, float tolerance)
+    : maxStep(maxStep), tolerance(tolerance), accepted(0), rejected(0)
+{
+}
+
+void DormandPrince::takeStep(ParticleSystem* particleSystem, float stepSize)
+{
+    size_t n = particleSystem -> stateSize();
+    float* y = particleSystem -> state();
+    float* k1 = particleSystem -> scratch(9 * n + 1);
+    float* k2 = k1 + n;
+    float* k3 = k2 + n;
+    float* k4 = k3 + n;
+    float* k5 = k4 + n;
+    float* k6 = k5 + n;
+    float* k7 = k6 + n;
+    float* s = k7 + n;
+    float* yNew = s + n;
+    // the last scratch float carries the substep size across calls
+    float& hint = yNew[n];
+
+    float h = hint > 0 ? hint : maxStep;
+    float t = 0;
+    particleSystem -> evalF(y, k1, n);
+
+    while (t < stepSize) {
+        float remaining = stepSize - t;
+        bool clipped = h >= remaining;
+        float hs = std::min(std::min(h, remaining), maxStep);
+
+        for (size_t i = 0; i < n; i++) {
+            s[i] = y[i] + hs * A21 * k1[i];
+        }
+        particleSystem -> evalF(s, k2, n);
+        for (size_t i = 0; i < n; i++) {
+            s[i] = y[i] + hs * (A31 * k1[i] + A32 * k2[i]);
+        }
+        particleSystem -> evalF(s, k3, n);
+        for (size_t i = 0; i < n; i++) {
+            s[i] = y[i] + hs * (A41 * k1[i] + A42 * k2[i] + A43 * k3[i]);
+        }
+        particleSystem -> evalF(s, k4, n);
+        for (size_t i = 0; i < n; i++) {
+            s[i] = y[i] + hs * (A51 * k1[i] + A52 * k2[i] + A53 * k3[i] + A54 * k4[i]);
+        }
+        particleSystem -> evalF(s, k5, n);
+        for (size_t i = 0; i < n; i++) {
+            s[i] = y[i] + hs * (A61 * k1[i] + A62 * k2[i] + A63 * k3[i] + A64 * k4[i] + A65 * k5[i]);
+        }
+        particleSystem -> evalF(s, k6, n);
+        for (size_t i = 0; i < n; i++) {
+            yNew[i] = y[i] + hs * (B1 * k1[i] + B3 * k3[i] + B4 * k4[i] + B5 * k5[i] + B6 * k6[i]);
+        }
+        particleSystem -> evalF(yNew, k7, n);
+
+        // RMS of the error estimate, scaled by a mixed absolute/relative tolerance
+        float sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            float e = hs * (E1 * k1[i] + E3 * k3[i] + E4 * k4[i] + E5 * k5[i] + E6 * k6[i] + E7 * k7[i]);
+            float scale = tolerance * (1 + std::max(std::fabs(y[i]), std::fabs(yNew[i])));
+            sum += (e / scale) * (e / scale);
+        }
+        float err = std::sqrt(sum / n);
+
+        // grow or shrink the substep, within limits, to aim for err = 1
+        float factor = err > 0 ? 0.9f * std::pow(err, -0.2f) : 5.0f;
+        factor = std::min(5.0f, std::max(0.2f, factor));
+
+        if (err <= 1 || hs <= MIN_STEP) {
+            std::copy(yNew, yNew + n, y);
+            std::swap(k1, k7);
+            t += hs;
+            accepted++;
+            // a substep cut short to land on stepSize says little about the next one
+            if (!clipped) {
+                h = hs * factor;
+            }
+        } else {
+            h = hs * std::min(1.0f, factor);
+            rejected++;
+        }
+    }
+    hint = std::min(h, maxStep);
+}
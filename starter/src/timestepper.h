@@ -3,6 +3,7 @@
 
 #include "vecmath.h"
 #include <vector>
+#include <atomic>
 #include "particlesystem.h"
 
 class TimeStepper
@@ -10,6 +11,15 @@ class TimeStepper
 public:
     virtual ~TimeStepper() {}
 	virtual void takeStep(ParticleSystem* particleSystem, float stepSize) = 0;
+
+    // Adaptive integrators choose their own substeps inside takeStep,
+    // so the caller should hand them the whole interval to advance.
+    virtual bool isAdaptive() const { return false; }
+
+    // The method in integrators.h behind this stepper, for callers that
+    // run it over several systems at once (see StrandBatch). Steppers
+    // without one return false.
+    virtual bool staticMethod(StepMethod* method) const { return false; }
 };
 
 //IMPLEMENT YOUR TIMESTEPPERS
@@ -17,16 +27,103 @@ public:
 class ForwardEuler : public TimeStepper
 {
 	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+    bool staticMethod(StepMethod* method) const override { *method = STEP_FORWARD_EULER; return true; }
 };
 
 class Trapezoidal : public TimeStepper
 {
 	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+    bool staticMethod(StepMethod* method) const override { *method = STEP_TRAPEZOIDAL; return true; }
 };
 
 class RK4 : public TimeStepper
 {
 	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+    bool staticMethod(StepMethod* method) const override { *method = STEP_RK4; return true; }
+};
+
+// Linearly implicit backward Euler (one Newton step per time step).
+// Solves (I (1 + h c) - h^2 da/dx) v' = v + h a + h c v with the banded
+// Jacobian of the system, then x' = x + h v'. Stays stable with stiff
+// springs at frame-sized steps, at the price of some numerical damping.
+// Systems without Jacobians get a symplectic Euler step instead.
+class ImplicitEuler : public TimeStepper
+{
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+};
+
+// Semi-implicit (symplectic) Euler: v' = v + h a(x, v), then x' = x + h v'.
+// One force evaluation per step and no energy drift on the springs.
+class SymplecticEuler : public TimeStepper
+{
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+    bool staticMethod(StepMethod* method) const override { *method = STEP_SYMPLECTIC_EULER; return true; }
+};
+
+// Velocity Verlet. Second order with one force evaluation per step: the
+// acceleration at the end of a step is kept for the start of the next.
+// Drag depends on the velocity, so the new acceleration is evaluated at
+// the half-step velocity.
+class VelocityVerlet : public TimeStepper
+{
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+    bool staticMethod(StepMethod* method) const override { *method = STEP_VELOCITY_VERLET; return true; }
+};
+
+// Position-based dynamics: external forces move the particles freely,
+// then the distance constraints and collisions pull them back into place
+// and the velocities follow from how far they actually moved. Stable at
+// frame-sized steps since no spring force is ever integrated.
+//
+// GAUSS_SEIDEL relaxes all constraints over a number of iterations.
+// FOLLOW_THE_LEADER projects the soft constraints once, then places each
+// particle of the inextensible chains at its rest length from its
+// leader in one pass from root to tip, and corrects the velocities for
+// the pull of the followers ("Fast Simulation of Inextensible Hair and
+// Fur", Mueller et al. 2012).
+//
+// Systems without constraints get a symplectic Euler step instead.
+class PositionBased : public TimeStepper
+{
+public:
+    enum Mode {
+        GAUSS_SEIDEL,
+        FOLLOW_THE_LEADER
+    };
+
+    // iterations only matter for GAUSS_SEIDEL
+    PositionBased(Mode mode, int iterations = 4);
+
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+
+private:
+    Mode mode;
+    int iterations;
+};
+
+// Embedded Runge-Kutta 5(4) of Dormand and Prince with step size control.
+// takeStep advances the system by the full stepSize, splitting it into
+// as many substeps as the local error estimate asks for, never longer
+// than maxStep. The last stage of an accepted substep is the first stage
+// of the next one (FSAL), so an accepted substep costs six evaluations.
+// The substep size that worked last is remembered per system.
+class DormandPrince : public TimeStepper
+{
+public:
+    DormandPrince(float maxStep, float tolerance = 1e-3f);
+
+	void takeStep(ParticleSystem* particleSystem, float stepSize) override;
+    bool isAdaptive() const override { return true; }
+
+    // totals over all systems since construction
+    long acceptedSteps() const { return accepted; }
+    long rejectedSteps() const { return rejected; }
+
+private:
+    float maxStep;
+    float tolerance;
+    std::atomic<long> accepted;
+    std::atomic<long> rejected;
 };
 
 /////////////////////////
@@ -0,0 +1,47 @@
+#ifndef HAIR_SIMULATION_TRIPLEBUFFER_H
+#define HAIR_SIMULATION_TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Hands complete values from one writer thread to one reader thread
+// without locks. The writer fills its own buffer and publishes it by
+// swapping it with the middle one; the reader swaps the middle one with
+// its own when something new was published. Neither ever waits for the
+// other, and the reader always gets the latest complete value.
+template <class T>
+class TripleBuffer {
+public:
+  TripleBuffer() : middle(1), back(0), front(2) {}
+
+  // writer: the buffer to fill, then publish() it
+  T& writeBuffer() { return buffers[back]; }
+  void publish() {
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  // reader: pick up the latest published buffer, if there is a new one.
+  // Returns whether readBuffer() changed.
+  bool update() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+      return false;
+    }
+    front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+  const T& readBuffer() const { return buffers[front]; }
+
+  // all three buffers, for setting them up before the threads start
+  T& buffer(int i) { return buffers[i]; }
+
+private:
+  static const int INDEX = 3;
+  static const int FRESH = 4;
+
+  T buffers[3];
+  // index of the middle buffer, plus FRESH when the writer put it there
+  std::atomic<int> middle;
+  int back;
+  int front;
+};
+
+#endif //HAIR_SIMULATION_TRIPLEBUFFER_H
@@ -0,0 +1,82 @@
+#include "windfield.h"
+#include "windfieldkernel.h"
+#include "scalarlanes.h"
+
+#include <cmath>
+
+using namespace std;
+
+#ifdef HAIR_SIMD_X86
+// windfield_avx2.cpp and windfield_avx512.cpp
+void sampleWindAvx2(const WindField::Params& p, int count, const float* x, const float* y, const float* z,
+                    float* wx, float* wy, float* wz);
+void sampleWindAvx512(const WindField::Params& p, int count, const float* x, const float* y, const float* z,
+                      float* wx, float* wy, float* wz);
+#endif
+
+namespace {
+  // eddies drift downwind this many of their own sizes a second at a
+  // mean of 1, and the curl of the noise is about this strong, RMS
+  const float DRIFT = 0.2f;
+  const float CURL_RMS = 1.9f;
+
+  // smooth noise in [-1, 1] over time, a random value every whole t
+  // blended with the same fade as the field
+  float gustNoise(float t) {
+    float i = floor(t);
+    float f = t - i;
+    float w = f * f * f * (f * (f * 6 - 15) + 10);
+    float a = WindNoise<ScalarLanes>::hash(i, 7, 3);
+    float b = WindNoise<ScalarLanes>::hash(i + 1, 7, 3);
+    return a + (b - a) * w;
+  }
+}
+
+WindField::WindField(float turbulence, float scale, float gusts, float gustPeriod)
+  : turbulence(turbulence), scale(scale), gusts(gusts), gustPeriod(gustPeriod), radius(0), time(0) {
+  source[0] = source[1] = source[2] = 0;
+  drift[0] = drift[1] = drift[2] = 0;
+  float still[3] = { 0, 0, 0 };
+  setTime(0, still);
+}
+
+void WindField::setFalloff(const float source[3], float radius) {
+  for (int c = 0; c < 3; c++) {
+    this->source[c] = source[c];
+  }
+  this->radius = radius;
+}
+
+void WindField::setTime(double t, const float mean[3]) {
+  float speed = sqrt(mean[0] * mean[0] + mean[1] * mean[1] + mean[2] * mean[2]);
+  float gust = gustPeriod > 0 ? max(0.0f, 1 + gusts * gustNoise((float) (t / gustPeriod))) : 1;
+  // time going back, as when a wind volume restarts, doesn't drift back
+  double elapsed = max(0.0, t - time);
+  time = t;
+  params.inverseScale = 1 / scale;
+  for (int c = 0; c < 3; c++) {
+    drift[c] += mean[c] * DRIFT * elapsed / scale;
+    params.wind[c] = mean[c] * gust;
+    params.drift[c] = (float) drift[c];
+    params.source[c] = source[c];
+  }
+  params.eddy = turbulence * speed * gust / CURL_RMS;
+  params.inverseRadius2 = radius > 0 ? 1 / (radius * radius) : 0;
+}
+
+void WindField::sample(SimdLevel level, int count, const float* x, const float* y, const float* z,
+                       float* wx, float* wy, float* wz) const {
+  switch (level) {
+#ifdef HAIR_SIMD_X86
+    case SIMD_AVX512:
+      sampleWindAvx512(params, count, x, y, z, wx, wy, wz);
+      break;
+    case SIMD_AVX2:
+      sampleWindAvx2(params, count, x, y, z, wx, wy, wz);
+      break;
+#endif
+    default:
+      sampleWindField<ScalarLanes>(params, count, x, y, z, wx, wy, wz);
+      break;
+  }
+}
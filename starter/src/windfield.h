@@ -0,0 +1,65 @@
+#ifndef HAIR_SIMULATION_WINDFIELD_H
+#define HAIR_SIMULATION_WINDFIELD_H
+
+#include "strandbatch.h"
+
+// Wind that varies in space and time around a mean wind.
+//
+// The mean swings with gusts, a smooth random strength over time, and
+// eddies are laid over it: the curl of a noise field, which swirls
+// without sources or sinks the way air does. The eddies drift downwind
+// and scale with the mean. Everything fades with distance from a source
+// if one is set.
+//
+// The field is sampled for many points at once, one point per SIMD lane,
+// with the same kernel for every instruction set (windfieldkernel.h) so
+// every level gives the same values.
+class WindField {
+public:
+  // turbulence is the strength of the eddies against the mean and scale
+  // their size; gusts is how far the mean swings, as a fraction of it,
+  // every gustPeriod seconds or so
+  WindField(float turbulence, float scale, float gusts, float gustPeriod);
+
+  // Fade the wind to half at radius from source, and further out as the
+  // inverse square; 0 is no falloff, the default.
+  void setFalloff(const float source[3], float radius);
+
+  // The mean wind and time the next samples are taken at. The eddies
+  // drift with the mean the field had since the last call, so changing
+  // it moves them on from where they are.
+  void setTime(double t, const float mean[3]);
+
+  // Wind at count points given as x, y and z arrays, written to wx, wy
+  // and wz. Safe to call from several threads at once.
+  void sample(SimdLevel level, int count, const float* x, const float* y, const float* z,
+              float* wx, float* wy, float* wz) const;
+
+  // what sample() needs, fixed for a setTime()
+  struct Params {
+    // mean wind times the gust, and the eddy strength
+    float wind[3];
+    float eddy;
+    // noise coordinates are position / scale minus drift
+    float inverseScale;
+    float drift[3];
+    // falloff source and 1 / radius^2, 0 for none
+    float source[3];
+    float inverseRadius2;
+  };
+
+private:
+  float turbulence;
+  float scale;
+  float gusts;
+  float gustPeriod;
+  float source[3];
+  float radius;
+  // the time of the last setTime() and how far the eddies drifted by
+  // then, in noise cells
+  double time;
+  double drift[3];
+  Params params;
+};
+
+#endif //HAIR_SIMULATION_WINDFIELD_H
@@ -0,0 +1,14 @@
+// AVX2 version of the wind field kernel, 8 points per instruction.
+// Built with -mavx2 -ffp-contract=off and only called after
+// detectSimdLevel() has seen AVX2 on the CPU.
+#ifdef HAIR_SIMD_X86
+
+#include "avx2lanes.h"
+#include "windfieldkernel.h"
+
+void sampleWindAvx2(const WindField::Params& p, int count, const float* x, const float* y, const float* z,
+                    float* wx, float* wy, float* wz) {
+  sampleWindField<Avx2Lanes>(p, count, x, y, z, wx, wy, wz);
+}
+
+#endif
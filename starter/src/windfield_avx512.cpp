@@ -0,0 +1,14 @@
+// AVX-512 version of the wind field kernel, 16 points per instruction.
+// Built with -mavx512f -ffp-contract=off and only called after
+// detectSimdLevel() has seen AVX-512F on the CPU.
+#ifdef HAIR_SIMD_X86
+
+#include "avx512lanes.h"
+#include "windfieldkernel.h"
+
+void sampleWindAvx512(const WindField::Params& p, int count, const float* x, const float* y, const float* z,
+                      float* wx, float* wy, float* wz) {
+  sampleWindField<Avx512Lanes>(p, count, x, y, z, wx, wy, wz);
+}
+
+#endif
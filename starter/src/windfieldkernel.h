@@ -0,0 +1,141 @@
+#ifndef HAIR_SIMULATION_WINDFIELDKERNEL_H
+#define HAIR_SIMULATION_WINDFIELDKERNEL_H
+
+#include "windfield.h"
+
+// The wind field kernel, written once over a Lanes type like the batch
+// force kernel (strandbatchkernel.h), plus floor. It is included by
+// windfield.cpp for the scalar version and by one file per instruction
+// set. Noise is value noise on the integer lattice with a quintic fade,
+// hashed with float arithmetic only (Hoskins, "Hash without Sine") so
+// every lane runs the same instructions.
+
+template <class L>
+struct WindNoise {
+  typedef typename L::V V;
+
+  static V fract(V a) { return L::sub(a, L::floor(a)); }
+
+  // a value in [-1, 1] for the lattice point x y z
+  static V hash(V x, V y, V z) {
+    V px = fract(L::mul(x, L::set1(0.1031f)));
+    V py = fract(L::mul(y, L::set1(0.1031f)));
+    V pz = fract(L::mul(z, L::set1(0.1031f)));
+    const V shift = L::set1(31.32f);
+    V d = L::add(L::add(L::mul(px, L::add(pz, shift)), L::mul(py, L::add(py, shift))),
+                 L::mul(pz, L::add(px, shift)));
+    px = L::add(px, d);
+    py = L::add(py, d);
+    pz = L::add(pz, d);
+    V h = fract(L::mul(L::add(px, py), pz));
+    return L::sub(L::add(h, h), L::set1(1));
+  }
+
+  // noise at x y z and its gradient
+  static V noise(V x, V y, V z, V& gx, V& gy, V& gz) {
+    const V one = L::set1(1);
+    V ix = L::floor(x), iy = L::floor(y), iz = L::floor(z);
+    V fx = L::sub(x, ix), fy = L::sub(y, iy), fz = L::sub(z, iz);
+    V wx, wy, wz, dx, dy, dz;
+    fade(fx, wx, dx);
+    fade(fy, wy, dy);
+    fade(fz, wz, dz);
+    V jx = L::add(ix, one), jy = L::add(iy, one), jz = L::add(iz, one);
+
+    V a = hash(ix, iy, iz), b = hash(jx, iy, iz), c = hash(ix, jy, iz), d = hash(jx, jy, iz);
+    V e = hash(ix, iy, jz), f = hash(jx, iy, jz), g = hash(ix, jy, jz), h = hash(jx, jy, jz);
+
+    // trilinear in the faded weights, expanded so the gradient follows
+    V k1 = L::sub(b, a), k2 = L::sub(c, a), k3 = L::sub(e, a);
+    V k4 = L::sub(L::sub(L::add(a, d), b), c);
+    V k5 = L::sub(L::sub(L::add(a, g), c), e);
+    V k6 = L::sub(L::sub(L::add(a, f), b), e);
+    V k7 = L::sub(L::sub(L::sub(L::add(L::add(L::add(b, c), e), h), a), L::add(d, f)), g);
+
+    gx = L::mul(dx, L::add(L::add(k1, L::mul(k4, wy)), L::add(L::mul(k6, wz), L::mul(k7, L::mul(wy, wz)))));
+    gy = L::mul(dy, L::add(L::add(k2, L::mul(k5, wz)), L::add(L::mul(k4, wx), L::mul(k7, L::mul(wz, wx)))));
+    gz = L::mul(dz, L::add(L::add(k3, L::mul(k6, wx)), L::add(L::mul(k5, wy), L::mul(k7, L::mul(wx, wy)))));
+    V n = L::add(a, L::add(L::mul(k1, wx), L::add(L::mul(k2, wy), L::mul(k3, wz))));
+    n = L::add(n, L::add(L::mul(k4, L::mul(wx, wy)), L::add(L::mul(k5, L::mul(wy, wz)), L::mul(k6, L::mul(wz, wx)))));
+    return L::add(n, L::mul(k7, L::mul(wx, L::mul(wy, wz))));
+  }
+
+  // 6t^5 - 15t^4 + 10t^3 and its derivative
+  static void fade(V t, V& w, V& dw) {
+    V t2 = L::mul(t, t);
+    V inner = L::add(L::mul(t, L::sub(L::mul(t, L::set1(6)), L::set1(15))), L::set1(10));
+    w = L::mul(L::mul(t2, t), inner);
+    V u = L::sub(t, L::set1(1));
+    dw = L::mul(L::set1(30), L::mul(t2, L::mul(u, u)));
+  }
+};
+
+// Wind at the L::width points from x, y and z; see WindField::sample.
+template <class L>
+void sampleWindLanes(const WindField::Params& p, const float* x, const float* y, const float* z,
+                     float* wx, float* wy, float* wz) {
+  typedef typename L::V V;
+  typedef WindNoise<L> N;
+  // the three components of the potential are the same noise, offset
+  const float OFFSET[3][3] = { { 0, 0, 0 }, { 31.416f, -17.21f, 5.873f }, { -12.73f, 43.19f, -27.31f } };
+
+  V px = L::load(x), py = L::load(y), pz = L::load(z);
+  const V inverseScale = L::set1(p.inverseScale);
+  V ux = L::sub(L::mul(px, inverseScale), L::set1(p.drift[0]));
+  V uy = L::sub(L::mul(py, inverseScale), L::set1(p.drift[1]));
+  V uz = L::sub(L::mul(pz, inverseScale), L::set1(p.drift[2]));
+
+  // gradients of the potential components, g[k][axis]
+  V g[3][3];
+  for (int k = 0; k < 3; k++) {
+    N::noise(L::add(ux, L::set1(OFFSET[k][0])), L::add(uy, L::set1(OFFSET[k][1])),
+             L::add(uz, L::set1(OFFSET[k][2])), g[k][0], g[k][1], g[k][2]);
+  }
+  const V eddy = L::set1(p.eddy);
+  V cx = L::mul(eddy, L::sub(g[2][1], g[1][2]));
+  V cy = L::mul(eddy, L::sub(g[0][2], g[2][0]));
+  V cz = L::mul(eddy, L::sub(g[1][0], g[0][1]));
+  V vx = L::add(L::set1(p.wind[0]), cx);
+  V vy = L::add(L::set1(p.wind[1]), cy);
+  V vz = L::add(L::set1(p.wind[2]), cz);
+
+  if (p.inverseRadius2 > 0) {
+    V dx = L::sub(px, L::set1(p.source[0]));
+    V dy = L::sub(py, L::set1(p.source[1]));
+    V dz = L::sub(pz, L::set1(p.source[2]));
+    V d2 = L::add(L::mul(dx, dx), L::add(L::mul(dy, dy), L::mul(dz, dz)));
+    V fall = L::div(L::set1(1), L::add(L::set1(1), L::mul(d2, L::set1(p.inverseRadius2))));
+    vx = L::mul(vx, fall);
+    vy = L::mul(vy, fall);
+    vz = L::mul(vz, fall);
+  }
+  L::store(wx, vx);
+  L::store(wy, vy);
+  L::store(wz, vz);
+}
+
+// every point, a vector at a time, the last few through a padded copy
+template <class L>
+void sampleWindField(const WindField::Params& p, int count, const float* x, const float* y, const float* z,
+                     float* wx, float* wy, float* wz) {
+  int i = 0;
+  for (; i + L::width <= count; i += L::width) {
+    sampleWindLanes<L>(p, x + i, y + i, z + i, wx + i, wy + i, wz + i);
+  }
+  if (i < count) {
+    float in[3][L::width] = {}, out[3][L::width];
+    for (int k = i; k < count; k++) {
+      in[0][k - i] = x[k];
+      in[1][k - i] = y[k];
+      in[2][k - i] = z[k];
+    }
+    sampleWindLanes<L>(p, in[0], in[1], in[2], out[0], out[1], out[2]);
+    for (int k = i; k < count; k++) {
+      wx[k] = out[0][k - i];
+      wy[k] = out[1][k - i];
+      wz[k] = out[2][k - i];
+    }
+  }
+}
+
+#endif //HAIR_SIMULATION_WINDFIELDKERNEL_H
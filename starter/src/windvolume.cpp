@@ -0,0 +1,174 @@
+#include "windvolume.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+  const char MAGIC[8] = { 'H', 'A', 'I', 'R', 'W', 'N', 'D', '1' };
+  // frames start on page boundaries, and the prefetch touches one byte
+  // per page
+  const size_t PAGE = 4096;
+  // frames the prefetch thread keeps ahead of the first one in use
+  const int AHEAD = 2;
+}
+
+WindVolume::WindVolume()
+  : frameCount(0), inverseCell(1), frameTime(1), dataOffset(0), frameStride(0), blend(0),
+    wantedFrame(-1), fetchedFrame(-1), stopping(false) {
+  dims[0] = dims[1] = dims[2] = 0;
+  origin[0] = origin[1] = origin[2] = 0;
+  frames[0] = frames[1] = 0;
+}
+
+bool WindVolume::load(const string& path) {
+  close();
+  if (!file.open(path) || file.size() < sizeof(WindVolumeHeader)) {
+    file.close();
+    return false;
+  }
+  WindVolumeHeader header;
+  memcpy(&header, file.data(), sizeof(header));
+  size_t frameBytes = 3 * sizeof(float) * (size_t) max(0, header.dims[0]) * max(0, header.dims[1]) *
+                      max(0, header.dims[2]);
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != WIND_VOLUME_VERSION ||
+      header.dims[0] < 2 || header.dims[1] < 2 || header.dims[2] < 2 || header.frameCount < 1 ||
+      !(header.cell > 0) || !(header.frameTime > 0) || header.dataOffset < sizeof(header) ||
+      header.dataOffset % sizeof(float) != 0 || header.frameStride < frameBytes ||
+      header.frameStride % sizeof(float) != 0 ||
+      file.size() < header.dataOffset + (size_t) (header.frameCount - 1) * header.frameStride + frameBytes) {
+    file.close();
+    return false;
+  }
+
+  for (int c = 0; c < 3; c++) {
+    dims[c] = header.dims[c];
+    origin[c] = header.origin[c];
+  }
+  frameCount = header.frameCount;
+  inverseCell = 1 / header.cell;
+  frameTime = header.frameTime;
+  dataOffset = header.dataOffset;
+  frameStride = header.frameStride;
+  stopping = false;
+  wantedFrame = fetchedFrame = -1;
+  setTime(0);
+  prefetcher = thread(&WindVolume::prefetch, this);
+  return true;
+}
+
+void WindVolume::close() {
+  if (prefetcher.joinable()) {
+    {
+      lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wanted.notify_one();
+    prefetcher.join();
+  }
+  file.close();
+  frameCount = 0;
+}
+
+void WindVolume::setTime(double t) {
+  if (empty()) {
+    return;
+  }
+  double u = t / frameTime;
+  // NaN and times before the start play the first frame
+  u = u > 0 ? min(u, (double) (frameCount - 1)) : 0;
+  int first = min((int) u, max(0, frameCount - 2));
+  frames[0] = first;
+  frames[1] = min(first + 1, frameCount - 1);
+  blend = frames[1] > first ? u - first : 0;
+
+  {
+    lock_guard<std::mutex> lock(mutex);
+    // playing back from an earlier frame starts the prefetch over, and
+    // skipping ahead skips the frames in between; either way it goes on
+    // from the first frame in use
+    if (wantedFrame > first + AHEAD) {
+      fetchedFrame = first - 1;
+    }
+    fetchedFrame = max(fetchedFrame, first - 1);
+    wantedFrame = min(first + AHEAD, frameCount - 1);
+  }
+  wanted.notify_one();
+}
+
+void WindVolume::prefetch() {
+  size_t frameBytes = 3 * sizeof(float) * (size_t) dims[0] * dims[1] * dims[2];
+  unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wanted.wait(lock, [this] { return stopping || fetchedFrame < wantedFrame; });
+    if (stopping) {
+      return;
+    }
+    int f = fetchedFrame + 1;
+    lock.unlock();
+    // reading a byte of every page makes the OS bring them all in
+    const volatile char* bytes = (const char*) frame(f);
+    char sum = 0;
+    for (size_t offset = 0; offset < frameBytes; offset += PAGE) {
+      sum += bytes[offset];
+    }
+    (void) sum;
+    lock.lock();
+    if (fetchedFrame == f - 1) {
+      fetchedFrame = f;
+    }
+  }
+}
+
+void WindVolume::addFrame(const float* values, const int cell[3], const float f[3], float weight, float* v) const {
+  int strideY = dims[0];
+  int strideZ = dims[0] * dims[1];
+  const float* base = values + 3 * (cell[2] * strideZ + cell[1] * strideY + cell[0]);
+  for (int corner = 0; corner < 8; corner++) {
+    int o[3] = { corner & 1, (corner >> 1) & 1, corner >> 2 };
+    float w = weight;
+    for (int a = 0; a < 3; a++) {
+      w *= o[a] ? f[a] : 1 - f[a];
+    }
+    const float* node = base + 3 * (o[2] * strideZ + o[1] * strideY + o[0]);
+    v[0] += w * node[0];
+    v[1] += w * node[1];
+    v[2] += w * node[2];
+  }
+}
+
+void WindVolume::sample(int count, const float* x, const float* y, const float* z,
+                        float* vx, float* vy, float* vz) const {
+  if (empty()) {
+    fill(vx, vx + count, 0.0f);
+    fill(vy, vy + count, 0.0f);
+    fill(vz, vz + count, 0.0f);
+    return;
+  }
+  const float* first = frame(frames[0]);
+  const float* second = frame(frames[1]);
+  for (int i = 0; i < count; i++) {
+    float p[3] = { x[i], y[i], z[i] };
+    float v[3] = { 0, 0, 0 };
+    int cell[3];
+    float f[3];
+    bool inside = true;
+    for (int a = 0; a < 3; a++) {
+      float u = (p[a] - origin[a]) * inverseCell;
+      // also false for NaN
+      inside = inside && u >= 0 && u <= dims[a] - 1;
+      cell[a] = inside ? min((int) u, dims[a] - 2) : 0;
+      f[a] = u - cell[a];
+    }
+    if (inside) {
+      addFrame(first, cell, f, 1 - blend, v);
+      if (blend > 0) {
+        addFrame(second, cell, f, blend, v);
+      }
+    }
+    vx[i] = v[0];
+    vy[i] = v[1];
+    vz[i] = v[2];
+  }
+}
@@ -0,0 +1,100 @@
+#ifndef HAIR_SIMULATION_WINDVOLUME_H
+#define HAIR_SIMULATION_WINDVOLUME_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "mappedfile.h"
+
+// Air velocity from an offline fluid solve: a sequence of frames of a
+// velocity grid, played back over time.
+//
+// The file is memory-mapped, so only the frames the hair gets to are
+// ever read from disk, and a prefetch thread touches the pages of the
+// frames coming up next while the simulation works on the current ones.
+// Velocities are interpolated trilinearly between grid points and
+// linearly between frames; outside the grid the air is still, and after
+// the last frame it holds.
+//
+// On disk a volume is a WindVolumeHeader followed by the frames, each
+// frameStride bytes from the last, the first at dataOffset. A frame is
+// vx vy vz per grid point, x fastest. Frames start on 4096 byte
+// boundaries so each one maps to whole pages.
+
+// bump whenever the file layout changes
+const uint32_t WIND_VOLUME_VERSION = 1;
+
+struct WindVolumeHeader {
+  // "HAIRWND1"
+  char magic[8];
+  uint32_t version;
+  // offset of the first frame from the start of the file
+  uint32_t dataOffset;
+  // grid points along x, y and z, at least 2 each
+  int32_t dims[3];
+  int32_t frameCount;
+  // position of the first grid point and the spacing of the grid
+  float origin[3];
+  float cell;
+  // seconds between frames
+  float frameTime;
+  // bytes from one frame to the next
+  uint32_t frameStride;
+};
+
+class WindVolume {
+public:
+  WindVolume();
+  ~WindVolume() { close(); }
+
+  // returns false, leaving no volume, if the file can't be read
+  bool load(const std::string& path);
+  void close();
+  bool empty() const { return !file.isOpen(); }
+
+  // the time the next samples are taken at, not while any are; asks the
+  // prefetch thread for the frames after it
+  void setTime(double t);
+
+  // Air velocity at count points given as x, y and z arrays, written to
+  // vx, vy and vz. Safe to call from several threads at once.
+  void sample(int count, const float* x, const float* y, const float* z,
+              float* vx, float* vy, float* vz) const;
+
+private:
+  WindVolume(const WindVolume&);
+  WindVolume& operator=(const WindVolume&);
+
+  const float* frame(int f) const { return (const float*) (file.data() + dataOffset + (size_t) f * frameStride); }
+  // trilinear velocity of one frame at grid coordinates, added to v
+  // times weight
+  void addFrame(const float* values, const int cell[3], const float f[3], float weight, float* v) const;
+  // touch the pages of frames as they are asked for, until close()
+  void prefetch();
+
+  MappedFile file;
+  int dims[3];
+  int frameCount;
+  float origin[3];
+  float inverseCell;
+  float frameTime;
+  size_t dataOffset;
+  size_t frameStride;
+
+  // frames the samples blend, and the weight of the second
+  int frames[2];
+  float blend;
+
+  // the prefetch thread, the frame it should get to next and the one it
+  // got to, guarded by mutex
+  std::thread prefetcher;
+  std::mutex mutex;
+  std::condition_variable wanted;
+  int wantedFrame;
+  int fetchedFrame;
+  bool stopping;
+};
+
+#endif //HAIR_SIMULATION_WINDVOLUME_H